@@ -19,7 +19,9 @@
  * --------------------
  * This file provides a simple example for dumping the memory from a 
  * virtual machine into a file that can then be read using XenAccess
- * in file mode or using other volitle memory analysis tools.
+ * in file mode or using other volitle memory analysis tools.  Pages of
+ * zeros are left as holes, so the file is sparse.  Pass -z after the file
+ * name to write a compressed snapshot instead.
  *
  * File: dump-memory.c
  *
@@ -31,9 +33,16 @@
 #include <errno.h>
 #include <sys/mman.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <xenaccess/xenaccess.h>
 
 #ifdef ENABLE_XEN
+/* returns nonzero if the page holds only zeros */
+int is_zero_page (unsigned char *memory, uint32_t length)
+{
+    return 0 == memory[0] && 0 == memcmp(memory, memory + 1, length - 1);
+}
+
 int main (int argc, char **argv)
 {
     xa_instance_t xai;
@@ -41,7 +50,7 @@ int main (int argc, char **argv)
     FILE *f = NULL;
     unsigned char *memory = NULL;
     uint32_t offset = 0;
-    uint32_t address = 0;
+    uint64_t address = 0;
 
     /* this is the domain ID that we are looking at */
     uint32_t dom = atoi(argv[1]);
@@ -55,6 +64,14 @@ int main (int argc, char **argv)
         goto error_exit;
     }
 
+    /* write a compressed snapshot if asked to */
+    if (argc > 3 && strcmp(argv[3], "-z") == 0){
+        if (xa_write_snapshot(&xai, filename) == XA_FAILURE){
+            perror("failed to write snapshot");
+        }
+        goto error_exit;
+    }
+
     /* open the file for writing */
     if ((f = fopen(filename, "w+")) == NULL){
         perror("failed to open file for writing");
@@ -67,34 +84,35 @@ int main (int argc, char **argv)
         /* access the memory */
         memory = xa_access_pa(&xai, address, &offset, PROT_READ);
 
-        /* write memory to file */
-        if (memory){
-            /* memory mapped, just write to file */
+        /* write memory to file, leaving holes where there are only zeros */
+        if (memory && !is_zero_page(memory, xai.page_size)){
+            if (fseeko(f, address, SEEK_SET) != 0){
+                perror("failed to seek in file");
+                goto error_exit;
+            }
             size_t written = fwrite(memory, 1, xai.page_size, f);
             if (written != xai.page_size){
                 perror("failed to write memory to file");
                 goto error_exit;
             }
-            munmap(memory, xai.page_size);
         }
-        else{
-            /* memory not mapped, write zeros to maintain offset */
-            unsigned char *zeros = malloc(xai.page_size);
-            memset(zeros, 0, xai.page_size);
-            size_t written = fwrite(zeros, 1, xai.page_size, f);
-            if (written != xai.page_size){
-                perror("failed to write zeros to file");
-                goto error_exit;
-            }
-            free(zeros);
+        if (memory){
+            xa_munmap(&xai, memory, xai.page_size);
+            memory = NULL;
         }
 
         /* move on to the next page */
         address += xai.page_size;
     }
 
+    /* extend the file over any hole at the end to keep the full size */
+    if (fflush(f) != 0 || ftruncate(fileno(f), xai.m.xen.size) != 0){
+        perror("failed to set file size");
+        goto error_exit;
+    }
+
 error_exit:
-    if (memory){ munmap(memory, xai.page_size); }
+    if (memory){ xa_munmap(&xai, memory, xai.page_size); }
     if (f){ fclose(f); }
 
     /* cleanup any memory associated with the XenAccess instance */
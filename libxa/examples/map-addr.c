@@ -64,7 +64,7 @@ int main (int argc, char **argv)
 error_exit:
 
     /* sanity check to unmap shared pages */
-    if (memory) munmap(memory, xai.page_size);
+    if (memory) xa_munmap(&xai, memory, xai.page_size);
 
     /* cleanup any memory associated with the XenAccess instance */
     xa_destroy(&xai);
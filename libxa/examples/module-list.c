@@ -46,7 +46,7 @@ void print_unicode_string (xa_instance_t *xai, uint16_t len, uint32_t addr)
     if (memory){
         memset(name, 0, len);
         memcpy(tmpname, memory + offset, len);
-        munmap(memory, xai->page_size);
+        xa_munmap(xai, memory, xai->page_size);
         for (i = 0; i < len; i++){
             if (i%2 == 0){
                 name[i/2] = tmpname[i];
@@ -91,7 +91,7 @@ int main (int argc, char **argv)
             goto error_exit;
         }
         memcpy(&next_module, memory + offset, 4);
-        munmap(memory, xai.page_size);
+        xa_munmap(&xai, memory, xai.page_size);
     }
     list_head = next_module;
 
@@ -130,13 +130,13 @@ int main (int argc, char **argv)
             memcpy(&buffer_addr, memory + offset + 0x30, 4);
             print_unicode_string(&xai, length, buffer_addr);
         }
-        munmap(memory, xai.page_size);
+        xa_munmap(&xai, memory, xai.page_size);
     }
 
 error_exit:
 
     /* sanity check to unmap shared pages */
-    if (memory) munmap(memory, xai.page_size);
+    if (memory) xa_munmap(&xai, memory, xai.page_size);
 
     /* cleanup any memory associated with the XenAccess instance */
     xa_destroy(&xai);
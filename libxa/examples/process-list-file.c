@@ -85,7 +85,7 @@ int main (int argc, char **argv)
         printf("[%5d] %s\n", pid, name);
     }
     list_head = next_process;
-    munmap(memory, xai.page_size);
+    xa_munmap(&xai, memory, xai.page_size);
 
     /* walk the task list */
     while (1){
@@ -131,13 +131,13 @@ int main (int argc, char **argv)
             continue;
         }
         printf("[%5d] %s\n", pid, name);
-        munmap(memory, xai.page_size);
+        xa_munmap(&xai, memory, xai.page_size);
     }
 
 error_exit:
 
     /* sanity check to unmap shared pages */
-    if (memory) munmap(memory, xai.page_size);
+    if (memory) xa_munmap(&xai, memory, xai.page_size);
 
     /* cleanup any memory associated with the XenAccess instance */
     xa_destroy(&xai);
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2005 - 2008  Bryan D. Payne (bryan@thepaynes.cc)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * --------------------
+ * This file measures the cost of a virtual to physical translation.
+ * It builds non-PAE and PAE page tables in a local buffer, opens the
+ * buffer with the mock backend, and times xa_pagetable_lookup for
+ * random addresses in 4KB pages and in large pages.  No hypervisor or
+ * image file is needed.
+ *
+ * File: translate-bench.c
+ *
+ * Author(s): Bryan D. Payne (bryan@thepaynes.cc)
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <xenaccess/xenaccess.h>
+#include <xenaccess/xa_private.h>
+
+#define MEMORY_SIZE (64 << 20)
+#define SMALL_BASE 0x40000000
+#define LARGE_BASE 0x80000000
+#define NOPAE_CR3 0x100000
+#define PAE_CR3 0x200000
+#define NUM_ADDRESSES (1 << 16)
+#define NUM_ROUNDS 64
+
+static unsigned char *memory = NULL;
+
+static void set32 (uint32_t paddr, uint32_t value)
+{
+    memcpy(memory + paddr, &value, sizeof(value));
+}
+
+static void set64 (uint32_t paddr, uint64_t value)
+{
+    memcpy(memory + paddr, &value, sizeof(value));
+}
+
+/* maps all of memory twice, once with 4KB pages and once with large pages */
+static void build_page_tables ()
+{
+    uint32_t i = 0;
+
+    /* non-PAE: 4MB per directory entry */
+    for (i = 0; i < MEMORY_SIZE >> 22; ++i){
+        uint32_t pt = NOPAE_CR3 + 0x1000 + i * 0x1000;
+        uint32_t j = 0;
+
+        set32(NOPAE_CR3 + ((SMALL_BASE >> 22) + i) * 4, pt | 0x63);
+        for (j = 0; j < 1024; ++j){
+            set32(pt + j * 4, ((i << 22) + (j << 12)) | 0x63);
+        }
+        set32(NOPAE_CR3 + ((LARGE_BASE >> 22) + i) * 4, (i << 22) | 0xe3);
+    }
+
+    /* PAE: 2MB per directory entry, one directory per 1GB */
+    set64(PAE_CR3 + (SMALL_BASE >> 30) * 8, (PAE_CR3 + 0x1000) | 0x1);
+    set64(PAE_CR3 + (LARGE_BASE >> 30) * 8, (PAE_CR3 + 0x2000) | 0x1);
+    for (i = 0; i < MEMORY_SIZE >> 21; ++i){
+        uint32_t pt = PAE_CR3 + 0x3000 + i * 0x1000;
+        uint32_t j = 0;
+
+        set64(PAE_CR3 + 0x1000 + i * 8, pt | 0x63);
+        for (j = 0; j < 512; ++j){
+            set64(pt + j * 8, ((i << 21) + (j << 12)) | 0x63);
+        }
+        set64(PAE_CR3 + 0x2000 + i * 8, (i << 21) | 0xe3);
+    }
+}
+
+/* returns the average time for one translation, in nanoseconds */
+static double time_lookups (
+        xa_instance_t *xai, uint32_t cr3, uint32_t *addrs, uint32_t base)
+{
+    struct timeval start, end;
+    uint64_t errors = 0;
+    uint32_t round = 0;
+    uint32_t i = 0;
+    double usec = 0;
+
+    gettimeofday(&start, NULL);
+    for (round = 0; round < NUM_ROUNDS; ++round){
+        for (i = 0; i < NUM_ADDRESSES; ++i){
+            if (xa_pagetable_lookup(xai, cr3, addrs[i]) != addrs[i] - base){
+                ++errors;
+            }
+        }
+    }
+    gettimeofday(&end, NULL);
+
+    if (errors){
+        fprintf(stderr, "ERROR: %llu bad translations\n",
+            (unsigned long long) errors);
+    }
+    usec = (end.tv_sec - start.tv_sec) * 1000000.0 +
+        (end.tv_usec - start.tv_usec);
+    return usec * 1000.0 / ((double) NUM_ROUNDS * NUM_ADDRESSES);
+}
+
+static void run (xa_instance_t *xai, char *mode, uint32_t cr3,
+        uint32_t *small, uint32_t *large)
+{
+    printf("%-8s 4KB pages: %7.1f ns   large pages: %7.1f ns\n", mode,
+        time_lookups(xai, cr3, small, SMALL_BASE),
+        time_lookups(xai, cr3, large, LARGE_BASE));
+}
+
+int main (int argc, char **argv)
+{
+    xa_instance_t xai;
+    uint32_t *small = NULL;
+    uint32_t *large = NULL;
+    uint32_t i = 0;
+
+    memory = calloc(1, MEMORY_SIZE);
+    small = malloc(NUM_ADDRESSES * sizeof(uint32_t));
+    large = malloc(NUM_ADDRESSES * sizeof(uint32_t));
+    if (NULL == memory || NULL == small || NULL == large){
+        perror("failed to allocate memory");
+        goto error_exit;
+    }
+    build_page_tables();
+
+    srand(1);
+    for (i = 0; i < NUM_ADDRESSES; ++i){
+        uint32_t offset = ((uint32_t) rand() << 8 ^ rand()) % MEMORY_SIZE;
+        small[i] = SMALL_BASE + offset;
+        large[i] = LARGE_BASE + offset;
+    }
+
+    /* there is no config entry for the buffer, so init in lax mode */
+    if (xa_init_mock_lax(memory, MEMORY_SIZE, "bench", &xai) == XA_FAILURE){
+        perror("failed to init XenAccess library");
+        goto error_exit;
+    }
+
+    xai.pae = 0;
+    xai.pse = 1;
+    xa_set_paging_mode(&xai);
+    run(&xai, "non-PAE", NOPAE_CR3, small, large);
+
+    xai.pae = 1;
+    xa_set_paging_mode(&xai);
+    run(&xai, "PAE", PAE_CR3, small, large);
+
+    /* cleanup any memory associated with the XenAccess instance */
+    xa_destroy(&xai);
+
+error_exit:
+    if (memory) free(memory);
+    if (small) free(small);
+    if (large) free(large);
+    return 0;
+}
@@ -51,11 +51,11 @@ pyxa_instance_new(PyObject *self, PyObject *args) {
 static void
 pyxa_instance_dealloc(PyObject *self) {
     //printf("About to destroy PyXa instance at %p\n", &(pyxai(self)));
-    xa_destroy(&(pyxai(self)));
     if(pyxamem(self)) {
         //printf("About to unmap memory at %p\n", pyxamem(self));
-        munmap(pyxamem(self), PAGE_SIZE);
+        xa_munmap(&(pyxai(self)), pyxamem(self), PAGE_SIZE);
     }
+    xa_destroy(&(pyxai(self)));
     //printf("About to call PyObject_DEL on self at %p\n", self);
     PyObject_DEL(self);
 }
@@ -71,7 +71,7 @@ pyxa_read(PyObject *self, PyObject *args) {
     if (!PyArg_ParseTuple(args, "I", &pfn))
         return NULL;
     
-    if(pyxamem(self)) munmap(pyxamem(self), PAGE_SIZE);
+    if(pyxamem(self)) xa_munmap(&(pyxai(self)), pyxamem(self), PAGE_SIZE);
 
     pyxamem(self) = xa_access_pa(&(pyxai(self)), pfn, &offset, PROT_READ);
     
@@ -36,7 +36,12 @@
 typedef struct xa_config_entry {
     char domain_name[CONFIG_STR_LENGTH];
     char sysmap[CONFIG_STR_LENGTH];
+    char pagefile[CONFIG_STR_LENGTH];
+    char symcache[CONFIG_STR_LENGTH];
     char ostype[CONFIG_STR_LENGTH];
+    int symbol_cache_size;
+    int pid_cache_size;
+    int address_size;
     union {
         struct linux_offsets {
             int tasks;
@@ -280,7 +280,12 @@ int xa_parse_config (char *td)
 %token         WIN_IBA
 %token         WIN_PH
 %token         SYSMAPTOK
+%token         PAGEFILETOK
+%token         SYMCACHETOK
 %token         OSTYPETOK
+%token         SYMBOL_CACHE_SIZE
+%token         PID_CACHE_SIZE
+%token         ADDRESS_SIZE
 %token<str>    WORD
 %token<str>    FILENAME
 %token         QUOTE
@@ -313,8 +318,18 @@ assignment:
         |
         sysmap_assignment
         |
+        pagefile_assignment
+        |
+        symcache_assignment
+        |
         ostype_assignment
         |
+        symbol_cache_size_assignment
+        |
+        pid_cache_size_assignment
+        |
+        address_size_assignment
+        |
         linux_tasks_assignment
         |
         linux_mm_assignment
@@ -340,6 +355,30 @@ assignment:
         win_ph_assignment
         ;
 
+symbol_cache_size_assignment:
+        SYMBOL_CACHE_SIZE EQUALS NUM
+        {
+            int tmp = strtol($3, NULL, 0);
+            tmp_entry.symbol_cache_size = tmp;
+        }
+        ;
+
+pid_cache_size_assignment:
+        PID_CACHE_SIZE EQUALS NUM
+        {
+            int tmp = strtol($3, NULL, 0);
+            tmp_entry.pid_cache_size = tmp;
+        }
+        ;
+
+address_size_assignment:
+        ADDRESS_SIZE EQUALS NUM
+        {
+            int tmp = strtol($3, NULL, 0);
+            tmp_entry.address_size = tmp;
+        }
+        ;
+
 linux_tasks_assignment:
         LINUX_TASKS EQUALS NUM
         {
@@ -444,6 +483,22 @@ sysmap_assignment:
         }
         ;
 
+pagefile_assignment:
+        PAGEFILETOK EQUALS QUOTE FILENAME QUOTE 
+        {
+            snprintf(tmp_str, CONFIG_STR_LENGTH,"%s", $4);
+            memcpy(tmp_entry.pagefile, tmp_str, CONFIG_STR_LENGTH);
+        }
+        ;
+
+symcache_assignment:
+        SYMCACHETOK EQUALS QUOTE FILENAME QUOTE 
+        {
+            snprintf(tmp_str, CONFIG_STR_LENGTH,"%s", $4);
+            memcpy(tmp_entry.symcache, tmp_str, CONFIG_STR_LENGTH);
+        }
+        ;
+
 ostype_assignment:
         OSTYPETOK EQUALS QUOTE WORD QUOTE 
         {
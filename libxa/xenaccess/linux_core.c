@@ -34,6 +34,10 @@ int linux_init (xa_instance_t *instance)
     int ret = XA_SUCCESS;
     unsigned char *memory = NULL;
     uint32_t local_offset = 0;
+    uint64_t pae = 0;
+
+    /* symbols saved by an earlier run for this System.map */
+    xa_symcache_load(instance);
 
     if (linux_system_map_symbol_to_address(
              instance, "swapper_pg_dir", &instance->kpgd) == XA_FAILURE){
@@ -55,24 +59,35 @@ int linux_init (xa_instance_t *instance)
     xa_dbprint("**set instance->kpgd (0x%.8x).\n", instance->kpgd);
 //    printf("kpgd search --> 0x%.8x\n", xa_find_kernel_pd(instance));
 
+    /* a paging mode found by an earlier run saves a failed lookup */
+    if (!instance->ia32e &&
+        xa_symcache_lookup(instance, "@pae", &pae) && pae != instance->pae){
+        instance->pae = pae;
+        xa_set_paging_mode(instance);
+        xa_dbprint("**set instance->pae = %d (cached)\n", instance->pae);
+    }
+
     memory = xa_access_kernel_sym(instance, "init_task", &local_offset, PROT_READ);
-    if (NULL == memory){
+    /* long mode always uses PAE entries, so there is nothing to switch */
+    if (NULL == memory && !instance->ia32e){
         xa_dbprint("--address lookup failure, switching PAE mode\n");
         instance->pae = !instance->pae;
+        xa_set_paging_mode(instance);
         xa_dbprint("**set instance->pae = %d\n", instance->pae);
         memory = xa_access_kernel_sym(instance, "init_task", &local_offset, PROT_READ);
-        if (NULL == memory){
-            fprintf(stderr, "ERROR: failed to get task list head 'init_task'\n");
-            ret = xa_report_error(instance, 0, XA_EMINOR);
-            //TODO should we switch PAE mode back?
-            if (XA_FAILURE == ret) goto error_exit;
-        }
+    }
+    if (NULL == memory){
+        fprintf(stderr, "ERROR: failed to get task list head 'init_task'\n");
+        ret = xa_report_error(instance, 0, XA_EMINOR);
+        //TODO should we switch PAE mode back?
+        if (XA_FAILURE == ret) goto error_exit;
     }
     instance->init_task =
         *((uint32_t*)(memory + local_offset +
         instance->os.linux_instance.tasks_offset));
+    xa_symcache_add(instance, "@pae", instance->pae);
     xa_dbprint("**set instance->init_task (0x%.8x).\n", instance->init_task);
-    munmap(memory, instance->page_size);
+    xa_munmap(instance, memory, instance->page_size);
 
 error_exit:
     return ret;
@@ -71,19 +71,20 @@ unsigned char *linux_get_taskstruct (
         if (task_pid == pid){
             return memory;
         }
-        munmap(memory, instance->page_size);
+        xa_munmap(instance, memory, instance->page_size);
     }
 
 error_exit:
-    if (memory) munmap(memory, instance->page_size);
+    if (memory) xa_munmap(instance, memory, instance->page_size);
     return NULL;
 }
 
 /* finds the address of the page global directory for a given pid */
-uint32_t linux_pid_to_pgd (xa_instance_t *instance, int pid)
+uint64_t linux_pid_to_pgd (xa_instance_t *instance, int pid)
 {
     unsigned char *memory = NULL;
-    uint32_t pgd = 0, ptr = 0, offset = 0;
+    uint32_t pgd_va = 0, ptr = 0, offset = 0;
+    uint64_t pgd = 0;
     int mm_offset = instance->os.linux_instance.mm_offset;
     int tasks_offset = instance->os.linux_instance.tasks_offset;
     int pgd_offset = instance->os.linux_instance.pgd_offset;
@@ -98,11 +99,11 @@ uint32_t linux_pid_to_pgd (xa_instance_t *instance, int pid)
     /* now follow the pointer to the memory descriptor and
        grab the pgd value */
     memcpy(&ptr, memory + offset + mm_offset - tasks_offset, 4);
-    munmap(memory, instance->page_size);
-    xa_read_long_virt(instance, ptr + pgd_offset, 0, &pgd);
+    xa_munmap(instance, memory, instance->page_size);
+    xa_read_long_virt(instance, ptr + pgd_offset, 0, &pgd_va);
 
     /* convert pgd into a machine address */
-    pgd = xa_translate_kv2p(instance, pgd);
+    pgd = xa_translate_kv2p(instance, pgd_va);
 
     /* update the cache with this new pid->pgd mapping */
     xa_update_pid_cache(instance, pid, pgd);
@@ -111,11 +112,92 @@ error_exit:
     return pgd;
 }
 
+/* calls cb with the pgd of each task that has its own address space */
+int linux_for_each_process (
+        xa_instance_t *instance, xa_process_cb_t cb, void *ctx)
+{
+    unsigned char *memory = NULL;
+    uint32_t list_head = 0, next_process = 0, offset = 0;
+    uint32_t ptr = 0, pgd_va = 0;
+    uint64_t pgd = 0;
+    int task_pid = 0;
+    int pid_offset = instance->os.linux_instance.pid_offset;
+    int tasks_offset = instance->os.linux_instance.tasks_offset;
+    int mm_offset = instance->os.linux_instance.mm_offset;
+    int pgd_offset = instance->os.linux_instance.pgd_offset;
+
+    next_process = instance->init_task;
+    list_head = next_process;
+
+    do{
+        memory = xa_access_kernel_va(instance, next_process, &offset, PROT_READ);
+        if (NULL == memory){
+            fprintf(stderr, "ERROR: failed to get task list next pointer\n");
+            return XA_FAILURE;
+        }
+        memcpy(&next_process, memory + offset, 4);
+        memcpy(&task_pid, memory + offset + pid_offset - tasks_offset, 4);
+        memcpy(&ptr, memory + offset + mm_offset - tasks_offset, 4);
+        xa_munmap(instance, memory, instance->page_size);
+
+        /* kernel threads have no memory descriptor */
+        if (!ptr){
+            continue;
+        }
+        if (xa_read_long_virt(instance, ptr + pgd_offset, 0, &pgd_va) ==
+                XA_FAILURE){
+            continue;
+        }
+        pgd = xa_translate_kv2p(instance, pgd_va);
+        if (!pgd){
+            continue;
+        }
+        xa_update_pid_cache(instance, task_pid, pgd);
+
+        if (cb(instance, task_pid, pgd, ctx)){
+            return XA_FAILURE;
+        }
+    } while (next_process && next_process != list_head);
+
+    return XA_SUCCESS;
+}
+
+/* finds the end of the lowmem direct map, which is the value of
+   high_memory, or the most lowmem there can be if that isn't usable */
+uint32_t linux_lowmem_end (xa_instance_t *instance)
+{
+    uint32_t address = 0;
+    uint32_t end = 0;
+    uint64_t size = instance->backend->get_size(instance);
+    uint64_t limit = 0;
+
+    if (!instance->page_offset){
+        return 0;
+    }
+
+    /* the top 128MB of kernel space is kept for vmalloc and fixmaps */
+    limit = 0x100000000ULL - instance->page_offset - (128 << 20);
+    if (size < limit){
+        limit = size;
+    }
+    limit += instance->page_offset;
+
+    if (linux_system_map_symbol_to_address(
+            instance, "high_memory", &address) == XA_SUCCESS &&
+        xa_read_long_virt(instance, address, 0, &end) == XA_SUCCESS &&
+        end > instance->page_offset && end <= limit){
+        return end;
+    }
+
+    xa_dbprint("--high_memory not usable, lowmem ends at 0x%.8llx\n", limit);
+    return (uint32_t) limit;
+}
+
 void *linux_access_kernel_symbol (
         xa_instance_t *instance, char *symbol, uint32_t *offset, int prot)
 {
     uint32_t virt_address;
-    uint32_t address;
+    uint64_t address;
 
     /* check the LRU cache */
     if (xa_check_cache_sym(instance, symbol, 0, &address)){
@@ -151,7 +233,7 @@ int xa_linux_get_taskaddr (
 
     /* copy the information out of the memory descriptor */
     memcpy(&ptr, memory + offset + mm_offset - tasks_offset, 4);
-    munmap(memory, instance->page_size);
+    xa_munmap(instance, memory, instance->page_size);
     memory = xa_access_kernel_va(instance, ptr, &offset, PROT_READ);
     if (NULL == memory){
         fprintf(stderr, "ERROR: failed to follow mm pointer (0x%x)\n", ptr);
@@ -162,11 +244,11 @@ int xa_linux_get_taskaddr (
         memory + offset + addr_offset,
         sizeof(xa_linux_taskaddr_t)
     );
-    munmap(memory, instance->page_size);
+    xa_munmap(instance, memory, instance->page_size);
 
     return XA_SUCCESS;
 
 error_exit:
-    if (memory) munmap(memory, instance->page_size);
+    if (memory) xa_munmap(instance, memory, instance->page_size);
     return XA_FAILURE;
 }
@@ -21,7 +21,9 @@
  * --------------------
  * This file contains utility functions reading information from the
  * System.map file which contains symbol information from the linux
- * kernel created by nm.
+ * kernel created by nm.  The file is mapped into memory and indexed
+ * once per instance, with a hash table on the symbol names that
+ * points into the file, so lookups don't scan or copy it.
  *
  * File: linux_system_map.c
  *
@@ -32,44 +34,342 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "xa_private.h"
 
-int linux_system_map_symbol_to_address (
-        xa_instance_t *instance, char *symbol, uint32_t *address)
+#define XA_SYSMAP_MIN_BUCKETS 256
+
+static uint32_t linux_system_map_hash (const char *name, size_t length)
+{
+    uint32_t hash = 0x811c9dc5;
+    size_t i = 0;
+
+    for (i = 0; i < length; ++i){
+        hash = (hash ^ (unsigned char) name[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+static int linux_system_map_compare (const void *a, const void *b)
 {
-    FILE *f = NULL;
-    char *row = NULL;
-    int ret = XA_SUCCESS;
+    const struct xa_sysmap_symbol *x = a;
+    const struct xa_sysmap_symbol *y = b;
+
+    if (x->address != y->address){
+        return x->address < y->address ? -1 : 1;
+    }
+    return x->name < y->name ? -1 : (x->name > y->name);
+}
+
+/* parses one row in place, returns 0 if it isn't a symbol */
+static int linux_system_map_row (
+        const char *row, const char *end, uint32_t *address,
+        const char **name, uint32_t *length)
+{
+    const char *p = row;
+    uint32_t value = 0;
+
+    /* address, symbol type and name, separated by spaces */
+    for ( ; p < end && isxdigit((unsigned char) *p); ++p){
+        value = (value << 4) | (isdigit((unsigned char) *p) ?
+            *p - '0' : (tolower((unsigned char) *p) - 'a' + 10));
+    }
+    if (p == row){
+        return 0;
+    }
+    while (p < end && isspace((unsigned char) *p)) ++p;
+    while (p < end && !isspace((unsigned char) *p)) ++p;
+    while (p < end && isspace((unsigned char) *p)) ++p;
+
+    *name = p;
+    while (p < end && !isspace((unsigned char) *p)) ++p;
+    *length = p - *name;
+    *address = value;
+    return *length > 0;
+}
+
+/* builds the sorted array and the name hash table */
+static int linux_system_map_build (struct xa_sysmap *map)
+{
+    const char *p = map->data;
+    const char *end = map->data + map->size;
+    uint32_t space = 1;
+    uint32_t buckets = XA_SYSMAP_MIN_BUCKETS;
+    uint32_t i = 0;
+
+    while (p < end && NULL != (p = memchr(p, '\n', end - p))){
+        ++space;
+        ++p;
+    }
+    map->symbols = malloc(space * sizeof(struct xa_sysmap_symbol));
+    if (NULL == map->symbols){
+        return XA_FAILURE;
+    }
 
+    for (p = map->data; p < end; ){
+        const char *eol = memchr(p, '\n', end - p);
+        struct xa_sysmap_symbol *symbol = &map->symbols[map->count];
+        const char *name = NULL;
+
+        if (NULL == eol){
+            eol = end;
+        }
+        if (linux_system_map_row(
+                p, eol, &symbol->address, &name, &symbol->length)){
+            symbol->name = name - map->data;
+            map->count++;
+        }
+        p = eol + 1;
+    }
+
+    /* nm output is already in address order, but that isn't promised */
+    for (i = 1; i < map->count; ++i){
+        if (linux_system_map_compare(
+                &map->symbols[i - 1], &map->symbols[i]) > 0){
+            qsort(map->symbols, map->count,
+                  sizeof(struct xa_sysmap_symbol), linux_system_map_compare);
+            break;
+        }
+    }
+
+    while (buckets < map->count){
+        buckets <<= 1;
+    }
+    map->buckets = calloc(buckets, sizeof(uint32_t));
+    if (NULL == map->buckets){
+        return XA_FAILURE;
+    }
+    map->bucket_mask = buckets - 1;
+
+    /* added backwards, so a name that appears twice finds the lowest
+       address first, as a scan of the file would */
+    for (i = map->count; i > 0; --i){
+        struct xa_sysmap_symbol *symbol = &map->symbols[i - 1];
+        uint32_t bucket = linux_system_map_hash(
+            map->data + symbol->name, symbol->length) & map->bucket_mask;
+        symbol->hash_next = map->buckets[bucket];
+        map->buckets[bucket] = i;
+    }
+    return XA_SUCCESS;
+}
+
+/* predicts the path for Xen domains without a sysmap entry */
+static char *linux_system_map_path (xa_instance_t *instance)
+{
     if ((NULL == instance->sysmap) || (strlen(instance->sysmap) == 0)){
 #ifdef ENABLE_XEN
         instance->sysmap =
             linux_predict_sysmap_name(instance->m.xen.domain_id);
 #endif /* ENABLE_XEN */
     }
+    return instance->sysmap;
+}
 
-    if ((row = malloc(MAX_ROW_LENGTH)) == NULL ){
-        ret = XA_FAILURE;
-        goto error_exit;
+/* maps and indexes the System.map file the first time it is needed */
+static struct xa_sysmap *linux_system_map_load (xa_instance_t *instance)
+{
+    struct xa_sysmap *map = NULL;
+    struct stat s;
+    int fd = -1;
+
+    if (NULL != instance->sysmap_index){
+        return instance->sysmap_index;
     }
-    if ((f = fopen(instance->sysmap, "r")) == NULL){
+
+    if (NULL == linux_system_map_path(instance) ||
+        (fd = open(instance->sysmap, O_RDONLY)) == -1){
         fprintf(stderr, "ERROR: could not find System.map file after checking:\n");
         fprintf(stderr, "\t%s\n", instance->sysmap);
         fprintf(stderr, "To fix this problem, add the correct sysmap entry to /etc/xenaccess.conf\n");
-        ret = XA_FAILURE;
+        return NULL;
+    }
+    if (fstat(fd, &s) == -1){
+        fprintf(stderr, "ERROR: failed to stat System.map file %s\n",
+            instance->sysmap);
         goto error_exit;
     }
-    if (get_symbol_row(f, row, symbol, 2) == XA_FAILURE){
-        ret = XA_FAILURE;
+
+    if ((map = calloc(1, sizeof(struct xa_sysmap))) == NULL){
+        goto error_exit;
+    }
+    map->size = s.st_size;
+    if (map->size){
+        map->data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED == map->data){
+            perror("linux_symbols.c: System.map mmap failed");
+            map->data = NULL;
+            goto error_exit;
+        }
+    }
+    if (linux_system_map_build(map) == XA_FAILURE){
+        fprintf(stderr, "ERROR: failed to index System.map file %s\n",
+            instance->sysmap);
         goto error_exit;
     }
+    close(fd);
 
-    *address = (uint32_t) strtoul(row, NULL, 16);
+    xa_dbprint("--indexed %u symbols from %s\n", map->count, instance->sysmap);
+    instance->sysmap_index = map;
+    return map;
 
 error_exit:
-    if (row) free(row);
-    if (f) fclose(f);
-    return ret;
+    if (map){
+        instance->sysmap_index = map;
+        linux_destroy_system_map(instance);
+    }
+    close(fd);
+    return NULL;
+}
+
+/* finds a symbol by name, the name need not be null terminated */
+static struct xa_sysmap_symbol *linux_system_map_find (
+        struct xa_sysmap *map, const char *name, size_t length)
+{
+    uint32_t bucket = 0;
+    uint32_t i = 0;
+
+    if (0 == map->count){
+        return NULL;
+    }
+    bucket = linux_system_map_hash(name, length) & map->bucket_mask;
+    for (i = map->buckets[bucket]; i; i = map->symbols[i - 1].hash_next){
+        struct xa_sysmap_symbol *symbol = &map->symbols[i - 1];
+        if (symbol->length == length &&
+            memcmp(map->data + symbol->name, name, length) == 0){
+            return symbol;
+        }
+    }
+    return NULL;
+}
+
+int linux_system_map_symbol_to_address (
+        xa_instance_t *instance, char *symbol, uint32_t *address)
+{
+    struct xa_sysmap *map = NULL;
+    struct xa_sysmap_symbol *entry = NULL;
+    uint64_t value = 0;
+
+    /* symbols found by an earlier run need no System.map at all */
+    if (xa_symcache_lookup(instance, symbol, &value)){
+        *address = (uint32_t) value;
+        return XA_SUCCESS;
+    }
+
+    if ((map = linux_system_map_load(instance)) == NULL){
+        return XA_FAILURE;
+    }
+    if ((entry = linux_system_map_find(map, symbol, strlen(symbol))) == NULL){
+        return XA_FAILURE;
+    }
+
+    *address = entry->address;
+    xa_symcache_add(instance, symbol, *address);
+    return XA_SUCCESS;
+}
+
+int linux_system_map_address_to_symbol (
+        xa_instance_t *instance, uint32_t address,
+        char *name, size_t length, uint32_t *offset)
+{
+    struct xa_sysmap *map = NULL;
+    struct xa_sysmap_symbol *entry = NULL;
+    uint32_t low = 0;
+    uint32_t high = 0;
+
+    if ((map = linux_system_map_load(instance)) == NULL || 0 == length){
+        return XA_FAILURE;
+    }
+
+    /* the last symbol at or below the address */
+    high = map->count;
+    while (low < high){
+        uint32_t mid = low + (high - low) / 2;
+        if (map->symbols[mid].address <= address){
+            low = mid + 1;
+        }
+        else{
+            high = mid;
+        }
+    }
+    if (0 == low){
+        return XA_FAILURE;
+    }
+    entry = &map->symbols[low - 1];
+
+    if (entry->length < length){
+        length = entry->length + 1;
+    }
+    memcpy(name, map->data + entry->name, length - 1);
+    name[length - 1] = '\0';
+    *offset = address - entry->address;
+    return XA_SUCCESS;
+}
+
+uint32_t linux_system_map_prefetch (
+        xa_instance_t *instance, xa_prefetch_t *list, uint32_t count)
+{
+    struct xa_sysmap *map = NULL;
+    uint32_t found = 0;
+    uint32_t i = 0;
+
+    if ((map = linux_system_map_load(instance)) == NULL){
+        return 0;
+    }
+    for (i = 0; i < count; ++i){
+        struct xa_sysmap_symbol *entry =
+            linux_system_map_find(map, list[i].name, strlen(list[i].name));
+        if (NULL != entry){
+            list[i].address = entry->address;
+            list[i].found = 1;
+            ++found;
+        }
+    }
+    return found;
+}
+
+int linux_system_map_identity (xa_instance_t *instance, uint64_t *key)
+{
+    uint64_t fields[5];
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    struct stat s;
+    uint32_t i = 0;
+
+    /* the file is only read and indexed when a lookup misses the cache */
+    if (NULL == linux_system_map_path(instance) ||
+        stat(instance->sysmap, &s) == -1){
+        xa_dbprint("--could not stat System.map file %s\n",
+            instance->sysmap ? instance->sysmap : "");
+        return XA_FAILURE;
+    }
+    fields[0] = s.st_dev;
+    fields[1] = s.st_ino;
+    fields[2] = s.st_size;
+    fields[3] = s.st_mtime;
+    fields[4] = s.st_mtim.tv_nsec;
+    for (i = 0; i < 5; ++i){
+        hash = (hash ^ fields[i]) * 0x100000001b3ULL;
+    }
+    *key = hash;
+    return XA_SUCCESS;
+}
+
+void linux_destroy_system_map (xa_instance_t *instance)
+{
+    struct xa_sysmap *map = instance->sysmap_index;
+
+    if (NULL == map){
+        return;
+    }
+    if (map->data) munmap(map->data, map->size);
+    if (map->symbols) free(map->symbols);
+    if (map->buckets) free(map->buckets);
+    free(map);
+    instance->sysmap_index = NULL;
 }
@@ -104,6 +104,9 @@ int windows_init (xa_instance_t *instance)
     int ret = XA_SUCCESS;
     uint32_t sysproc = 0;
 
+    // symbols saved by an earlier run, which may also give the base
+    xa_symcache_load(instance);
+
     // get base address for kernel image in memory unless
     // it has already been set in the configuration file.
     if(instance->os.windows_instance.ntoskrnl == 0){
@@ -114,6 +117,8 @@ int windows_init (xa_instance_t *instance)
         }
         xa_dbprint("--got ntoskrnl (0x%.8x).\n", instance->os.windows_instance.ntoskrnl);
     }
+    xa_symcache_add(
+        instance, "@ntoskrnl", instance->os.windows_instance.ntoskrnl);
 
     /* get the kernel page directory location */
     if (get_kpgd_method1(instance, &sysproc) == XA_FAILURE){
@@ -34,10 +34,22 @@
 int windows_symbol_to_address (
         xa_instance_t *instance, char *symbol, uint32_t *address)
 {
+    uint64_t value = 0;
+
+    /* symbols found by an earlier run need no walk of the exports */
+    if (xa_symcache_lookup(instance, symbol, &value)){
+        *address = (uint32_t) value;
+        return XA_SUCCESS;
+    }
+
     /* check exports first */
-    return windows_export_to_rva(instance, symbol, address);
+    if (windows_export_to_rva(instance, symbol, address) == XA_SUCCESS){
+        xa_symcache_add(instance, symbol, *address);
+        return XA_SUCCESS;
+    }
 
     /*TODO check symbol server */
+    return XA_FAILURE;
 }
 
 /* find the ntoskrnl base address */
@@ -82,7 +94,7 @@ uint32_t get_ntoskrnl_base (xa_instance_t *instance)
             goto fast_exit;
         }
 
-        paddr += instance->page_size;
+        paddr = xa_next_data_page(instance, paddr + instance->page_size);
         if (paddr <= 0 || 0x40000000 <= paddr){
             xa_dbprint("--get_ntoskrnl_base failed\n");
             return 0;
@@ -98,7 +110,7 @@ void *windows_access_kernel_symbol (
 {
     uint32_t virt_address;
     uint32_t phys_address;
-    uint32_t address;
+    uint64_t address;
     uint32_t rva;
 
     /* check the LRU cache */
@@ -155,16 +167,16 @@ unsigned char *windows_get_EPROCESS (
         if (task_pid == pid){
             return memory;
         }
-        munmap(memory, instance->page_size);
+        xa_munmap(instance, memory, instance->page_size);
     }
 
 error_exit:
-    if (memory) munmap(memory, instance->page_size);
+    if (memory) xa_munmap(instance, memory, instance->page_size);
     return NULL;
 }
 
 /* finds the address of the page global directory for a given pid */
-uint32_t windows_pid_to_pgd (xa_instance_t *instance, int pid)
+uint64_t windows_pid_to_pgd (xa_instance_t *instance, int pid)
 {
     unsigned char *memory = NULL;
     uint32_t pgd = 0, ptr = 0, offset = 0;
@@ -181,16 +193,57 @@ uint32_t windows_pid_to_pgd (xa_instance_t *instance, int pid)
     /* now follow the pointer to the memory descriptor and
        grab the pgd value */
     pgd = *((uint32_t*)(memory + offset + pdbase_offset - tasks_offset));
-    munmap(memory, instance->page_size);
+    xa_munmap(instance, memory, instance->page_size);
 
     /* update the cache with this new pid->pgd mapping */
     xa_update_pid_cache(instance, pid, pgd);
 
 error_exit:
-    if (memory) munmap(memory, instance->page_size);
+    if (memory) xa_munmap(instance, memory, instance->page_size);
     return pgd;
 }
 
+/* calls cb with the page directory of each process */
+int windows_for_each_process (
+        xa_instance_t *instance, xa_process_cb_t cb, void *ctx)
+{
+    unsigned char *memory = NULL;
+    uint32_t list_head = 0, next_process = 0, offset = 0;
+    uint32_t pgd = 0;
+    int task_pid = 0;
+    int pid_offset = instance->os.windows_instance.pid_offset;
+    int tasks_offset = instance->os.windows_instance.tasks_offset;
+    int pdbase_offset = instance->os.windows_instance.pdbase_offset;
+
+    next_process = instance->init_task;
+    list_head = next_process;
+
+    do{
+        memory = xa_access_kernel_va(instance, next_process, &offset, PROT_READ);
+        if (NULL == memory){
+            fprintf(stderr, "ERROR: failed to get EPROCESS list next pointer\n");
+            return XA_FAILURE;
+        }
+        memcpy(&next_process, memory + offset, 4);
+        memcpy(&task_pid, memory + offset + pid_offset - tasks_offset, 4);
+        memcpy(&pgd, memory + offset + pdbase_offset - tasks_offset, 4);
+        xa_munmap(instance, memory, instance->page_size);
+
+        /* skip the list head in PsActiveProcessHead, which is not
+           part of an EPROCESS and has no page directory */
+        if (!pgd || pgd >= instance->backend->get_size(instance)){
+            continue;
+        }
+        xa_update_pid_cache(instance, task_pid, pgd);
+
+        if (cb(instance, task_pid, pgd, ctx)){
+            return XA_FAILURE;
+        }
+    } while (next_process && next_process != list_head);
+
+    return XA_SUCCESS;
+}
+
 /* fills the taskaddr struct for a given windows process */
 int xa_windows_get_peb (
         xa_instance_t *instance, int pid, xa_windows_peb_t *peb)
@@ -209,7 +262,7 @@ int xa_windows_get_peb (
         goto error_exit;
     }
     ptr = *((uint32_t*)(memory+offset + peb_offset - tasks_offset));
-    munmap(memory, instance->page_size);
+    xa_munmap(instance, memory, instance->page_size);
 
     /* copy appropriate values into peb struct */
     xa_read_long_virt(instance, ptr + iba_offset, pid, &(peb->ImageBaseAddress));
@@ -218,6 +271,6 @@ int xa_windows_get_peb (
     return XA_SUCCESS;
 
 error_exit:
-    if (memory) munmap(memory, instance->page_size);
+    if (memory) xa_munmap(instance, memory, instance->page_size);
     return XA_FAILURE;
 }
@@ -156,7 +156,7 @@ char *rva_to_string (xa_instance_t *instance, uint32_t rva)
         memset(str, 0, length + 1);
         memcpy(str, memory + offset, length);
     }
-    munmap(memory, instance->page_size);
+    xa_munmap(instance, memory, instance->page_size);
 
     /* someone else will need to free this */
     return str;
@@ -222,9 +222,9 @@ void dump_exports (xa_instance_t *instance, struct export_table et)
     }
     /*TODO this loop is running past the end of memory page */
 
-    munmap(memory1, instance->page_size);
-    munmap(memory2, instance->page_size);
-    munmap(memory3, instance->page_size);
+    xa_munmap(instance, memory1, instance->page_size);
+    xa_munmap(instance, memory2, instance->page_size);
+    xa_munmap(instance, memory3, instance->page_size);
 }
 
 int get_export_rva (
@@ -309,7 +309,7 @@ int get_export_table (xa_instance_t *instance, uint32_t base_addr, struct export
         return XA_FAILURE;
     }
     memcpy(&oh, memory + offset, sizeof(struct optional_header));
-    munmap(memory, instance->page_size);
+    xa_munmap(instance, memory, instance->page_size);
     export_header_rva = oh.idd[IMAGE_DIRECTORY_ENTRY_EXPORT].virtual_address;
 
     /* export header */
@@ -322,7 +322,7 @@ int get_export_table (xa_instance_t *instance, uint32_t base_addr, struct export
         return XA_FAILURE;
     }
     memcpy(et, memory + offset, sizeof(struct export_table));
-    munmap(memory, instance->page_size);
+    xa_munmap(instance, memory, instance->page_size);
 
     return XA_SUCCESS;
 }
@@ -354,6 +354,118 @@ int windows_export_to_rva (xa_instance_t *instance, char *symbol, uint32_t *rva)
     return get_export_rva(instance, rva, aof_index, &et);
 }
 
+/* compares the export name at rva with the list, without a copy */
+static xa_prefetch_t *windows_export_find (
+        xa_instance_t *instance, uint32_t rva,
+        xa_prefetch_t *list, uint32_t count)
+{
+    unsigned char *memory = NULL;
+    xa_prefetch_t *entry = NULL;
+    uint32_t offset = 0;
+    size_t length = 0;
+
+    memory = xa_access_pa(
+        instance,
+        instance->os.windows_instance.ntoskrnl + rva,
+        &offset,
+        PROT_READ);
+    if (NULL == memory){
+        return NULL;
+    }
+
+    /* a name that runs off the page can't be compared in place */
+    length = strnlen(
+        (const char *) memory + offset, instance->page_size - offset);
+    if (length < instance->page_size - offset){
+        entry = xa_prefetch_find(
+            list, count, (char *) memory + offset, length);
+    }
+    else{
+        char *str = rva_to_string(instance, rva);
+        if (NULL != str){
+            entry = xa_prefetch_find(list, count, str, strlen(str));
+            free(str);
+        }
+    }
+    xa_munmap(instance, memory, instance->page_size);
+    return entry;
+}
+
+uint32_t windows_export_prefetch (
+        xa_instance_t *instance, xa_prefetch_t *list, uint32_t count)
+{
+    uint32_t base_addr = instance->os.windows_instance.ntoskrnl;
+    struct export_table et;
+    uint32_t found = 0;
+    uint32_t i = 0;
+
+    if (get_export_table(instance, base_addr, &et) != XA_SUCCESS){
+        return 0;
+    }
+
+    for ( ; i < et.number_of_names && found < count; ++i){
+        uint32_t str_rva_loc =
+            base_addr + et.address_of_names + i * sizeof(uint32_t);
+        uint32_t str_rva = 0;
+        xa_prefetch_t *entry = NULL;
+        int aof_index = -1;
+
+        if (xa_read_long_phys(instance, str_rva_loc, &str_rva) == XA_FAILURE ||
+            0 == str_rva){
+            continue;
+        }
+        entry = windows_export_find(instance, str_rva, list, count);
+        if (NULL == entry || entry->found){
+            continue;
+        }
+        if ((aof_index = get_aof_index(instance, (int) i, &et)) != -1 &&
+            get_export_rva(instance, &entry->address, aof_index, &et) ==
+                XA_SUCCESS){
+            entry->found = 1;
+            ++found;
+        }
+    }
+    return found;
+}
+
+int windows_pe_identity (xa_instance_t *instance, uint32_t base, uint64_t *key)
+{
+    uint32_t value = 0;
+    uint32_t signature_location = 0;
+    unsigned char *memory = NULL;
+    uint32_t offset = 0;
+    struct file_header fh;
+    struct optional_header oh;
+
+    if (xa_read_long_phys(instance, base, &value) == XA_FAILURE ||
+        (value & 0xffff) != IMAGE_DOS_HEADER){
+        return XA_FAILURE;
+    }
+    xa_read_long_phys(instance, base + 60, &value);
+    signature_location = base + value;
+    if (xa_read_long_phys(instance, signature_location, &value) ==
+            XA_FAILURE || value != IMAGE_NT_SIGNATURE){
+        return XA_FAILURE;
+    }
+
+    /* the file header and optional header follow the signature */
+    memory = xa_access_pa(
+        instance, signature_location + 4, &offset, PROT_READ);
+    if (NULL == memory){
+        return XA_FAILURE;
+    }
+    if (offset + sizeof(fh) + sizeof(oh) > instance->page_size){
+        xa_munmap(instance, memory, instance->page_size);
+        return XA_FAILURE;
+    }
+    memcpy(&fh, memory + offset, sizeof(fh));
+    memcpy(&oh, memory + offset + sizeof(fh), sizeof(oh));
+    xa_munmap(instance, memory, instance->page_size);
+
+    *key = ((uint64_t) fh.time_date_stamp << 32) | oh.checksum;
+    return *key ? XA_SUCCESS : XA_FAILURE;
+}
+
 int valid_ntoskrnl_start (xa_instance_t *instance, uint32_t addr)
 {
     uint32_t value = 0;
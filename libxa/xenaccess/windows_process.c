@@ -32,35 +32,34 @@
 #include <stdlib.h>
 #include <sys/mman.h>
 #include "xenaccess.h"
+#include "xa_private.h"
 
-char *windows_get_eprocess_name (xa_instance_t *instance, uint32_t paddr)
+char *windows_get_eprocess_name (xa_instance_t *instance, uint64_t paddr)
 {
-    uint32_t name_paddr = paddr + 0x174; /*TODO replace hard coded value */
+    uint64_t name_paddr = paddr + 0x174; /*TODO replace hard coded value */
     uint32_t offset = 0;
+    char *name = NULL;
     char *memory = xa_access_pa(instance, name_paddr, &offset, PROT_READ);
     if (memory){
-        char *name = memory + offset;
-        return strndup(name, 50);
+        name = strndup(memory + offset, 50);
+        xa_munmap(instance, memory, instance->page_size);
     }
-    return NULL;
+    return name;
 }
 
 uint32_t windows_find_eprocess (xa_instance_t *instance, char *name)
 {
-    uint32_t end = 0;
-    uint32_t offset = 0;
+    uint64_t end = 0;
+    uint64_t offset = 0;
     uint32_t value = 0;
 
-    if (XA_MODE_XEN == instance->mode){
-#ifdef ENABLE_XEN
-        end = instance->m.xen.size;
-#endif /* ENABLE_XEN */
-    }
-    else if (XA_MODE_FILE == instance->mode){
-        end = instance->m.file.size;
-    }
+    end = instance->backend->get_size(instance);
     
     while (offset < end){
+        offset = xa_next_data_page(instance, offset);
+        if (offset >= end){
+            break;
+        }
         xa_read_long_phys(instance, offset, &value);
         // Magic header numbers.  See get_ntoskrnl_base for
         // an explanation.
@@ -32,211 +32,302 @@
  */
 #define _GNU_SOURCE
 #include <string.h>
-#include <time.h>
 #include "xa_private.h"
 
 #define MAX_SYM_LEN 512
 
-int xa_check_cache_sym (xa_instance_t *instance,
-                        char *symbol_name,
-                        int pid,
-                        uint32_t *mach_address)
+/* ========================================================= */
+/*     Cache implementation for kernel symbols below.        */
+/* ========================================================= */
+
+/* hash tables get a power of two buckets, at least one per entry */
+static uint32_t xa_cache_bucket_count (uint32_t size, uint32_t minimum)
 {
-    xa_cache_entry_t current;
-    int ret = 0;
+    uint32_t count = minimum;
+    while (count < size && count < 0x80000000U){
+        count <<= 1;
+    }
+    return count;
+}
 
-    current = instance->cache_head;
-    while (current != NULL){
-        if ((strncmp(current->symbol_name, symbol_name, MAX_SYM_LEN) == 0) &&
-            (current->pid == pid) && (current->mach_address)){
-            current->last_used = time(NULL);
-            *mach_address = current->mach_address;
-            ret = 1;
-            xa_dbprint("++Cache hit (%s --> 0x%.8x)\n",
-                symbol_name, *mach_address);
-            goto exit;
-        }
-        current = current->next;
+/* entries are hashed by symbol name and by virtual address, and kept
+   on a list from least to most recently used */
+static uint32_t xa_cache_symbol_hash (
+    xa_instance_t *instance, char *symbol_name, int pid)
+{
+    uint32_t hash = 2166136261U;
+    uint32_t i = 0;
+
+    for (i = 0; i < MAX_SYM_LEN && symbol_name[i]; ++i){
+        hash = (hash ^ (unsigned char) symbol_name[i]) * 16777619U;
     }
+    return (hash ^ (uint32_t) pid) & (instance->cache_bucket_count - 1);
+}
 
-exit:
-    return ret;
+static uint32_t xa_cache_virt_hash (
+    xa_instance_t *instance, xa_addr_t virt_address, int pid)
+{
+    uint32_t hash = (uint32_t) (virt_address ^ (virt_address >> 32)) ^
+        ((uint32_t) pid * 0x9e3779b1);
+    return (hash ^ (hash >> 16)) & (instance->cache_bucket_count - 1);
 }
 
-int xa_check_cache_virt (xa_instance_t *instance,
-                         uint32_t virt_address,
-                         int pid,
-                         uint32_t *mach_address)
+static void xa_cache_unlink (
+    xa_instance_t *instance, xa_cache_entry_t entry)
 {
-    xa_cache_entry_t current;
-    int ret = 0;
-    uint32_t lookup = virt_address & ~(instance->page_size - 1);
-
-    current = instance->cache_head;
-    for (current = instance->cache_head;
-         current != NULL;
-         current = current->next)
-    {
-        if (!current->virt_address){
-            continue;
-        }
-        else if ((current->virt_address == lookup) &&
-            (current->pid == pid) &&
-            (current->mach_address)){
-            current->last_used = time(NULL);
-            *mach_address = (current->mach_address |
-                (virt_address & (instance->page_size - 1)));
-            ret = 1;
-            xa_dbprint("++Cache hit (0x%.8x --> 0x%.8x, 0x%.8x)\n",
-                virt_address, *mach_address, current->mach_address);
-            goto exit;
-        }
+    if (NULL != entry->prev){
+        entry->prev->next = entry->next;
+    }
+    else{
+        instance->cache_head = entry->next;
+    }
+    if (NULL != entry->next){
+        entry->next->prev = entry->prev;
     }
+    else{
+        instance->cache_tail = entry->prev;
+    }
+}
 
-exit:
-    return ret;
+/* adds an entry at the most recently used end of the list */
+static void xa_cache_append (
+    xa_instance_t *instance, xa_cache_entry_t entry)
+{
+    entry->prev = instance->cache_tail;
+    entry->next = NULL;
+    if (NULL != instance->cache_tail){
+        instance->cache_tail->next = entry;
+    }
+    else{
+        instance->cache_head = entry;
+    }
+    instance->cache_tail = entry;
 }
 
-int xa_update_cache (xa_instance_t *instance,
-                     char *symbol_name,
-                     uint32_t virt_address,
-                     int pid,
-                     uint32_t mach_address)
+static void xa_cache_touch (
+    xa_instance_t *instance, xa_cache_entry_t entry)
 {
-    xa_cache_entry_t new_entry = NULL;
-    uint32_t vlookup = virt_address & ~(instance->page_size - 1);
-    uint32_t mlookup = mach_address & ~(instance->page_size - 1);
+    if (instance->cache_tail != entry){
+        xa_cache_unlink(instance, entry);
+        xa_cache_append(instance, entry);
+    }
+}
 
-    /* is cache enabled? */
-    if (XA_CACHE_SIZE == 0){
-        return 1;
+/* moves every entry into new tables with the given number of buckets */
+static int xa_cache_rehash (xa_instance_t *instance, uint32_t buckets)
+{
+    xa_cache_entry_t *symbols = NULL;
+    xa_cache_entry_t *virt = NULL;
+    xa_cache_entry_t current = NULL;
+
+    symbols = calloc(buckets, sizeof(xa_cache_entry_t));
+    virt = calloc(buckets, sizeof(xa_cache_entry_t));
+    if (NULL == symbols || NULL == virt){
+        free(symbols);
+        free(virt);
+        return XA_FAILURE;
     }
+    free(instance->cache_symbols);
+    free(instance->cache_virt);
+    instance->cache_symbols = symbols;
+    instance->cache_virt = virt;
+    instance->cache_bucket_count = buckets;
 
-    /* does anything match the passed symbol_name? */
-    /* if so, update other entries */
-    if (symbol_name){
-        xa_cache_entry_t current = instance->cache_head;
-        while (current != NULL){
-            if (strncmp(current->symbol_name, symbol_name, MAX_SYM_LEN) == 0){
-                current->last_used = time(NULL);
-                current->virt_address = 0;
-                current->pid = pid;
-                if (mach_address){
-                    current->mach_address = mach_address;
-                }
-                else{
-                    current->mach_address =
-                        xa_translate_kv2p(instance, virt_address);
-                }
-                xa_dbprint("++Cache update (%s --> 0x%.8x)\n",
-                    symbol_name, current->mach_address);
-                goto exit;
-            }
-            current = current->next;
-        }
+    for (current = instance->cache_head; NULL != current;
+         current = current->next){
+        uint32_t bucket =
+            xa_cache_symbol_hash(instance, current->symbol_name, current->pid);
+        current->symbol_next = symbols[bucket];
+        symbols[bucket] = current;
+        bucket = xa_cache_virt_hash(
+            instance, current->virt_address, current->pid);
+        current->virt_next = virt[bucket];
+        virt[bucket] = current;
     }
+    return XA_SUCCESS;
+}
 
-    /* does anything match the passed virt_address? */
-    /* if so, update other entries */
-    if (virt_address){
-        xa_cache_entry_t current = instance->cache_head;
-        while (current != NULL){
-            if (current->virt_address == vlookup){
-                current->last_used = time(NULL);
-                current->pid = pid;
-                current->mach_address = mlookup;
-                xa_dbprint("++Cache update (0x%.8x --> 0x%.8x)\n",
-                    vlookup, mlookup);
-                goto exit;
-            }
-            current = current->next;
-        }
+/* links an entry into the virtual address hash chain */
+static void xa_cache_virt_insert (
+    xa_instance_t *instance, xa_cache_entry_t entry)
+{
+    uint32_t bucket =
+        xa_cache_virt_hash(instance, entry->virt_address, entry->pid);
+    entry->virt_next = instance->cache_virt[bucket];
+    instance->cache_virt[bucket] = entry;
+}
+
+static void xa_cache_virt_remove (
+    xa_instance_t *instance, xa_cache_entry_t entry)
+{
+    xa_cache_entry_t *link = &instance->cache_virt[
+        xa_cache_virt_hash(instance, entry->virt_address, entry->pid)];
+    while (*link != entry){
+        link = &(*link)->virt_next;
     }
+    *link = entry->virt_next;
+}
 
-    /* was this a spurious call with bad info? */
-    if (!symbol_name && !virt_address){
-        goto exit;
+static void xa_cache_remove (
+    xa_instance_t *instance, xa_cache_entry_t entry)
+{
+    xa_cache_entry_t *link = &instance->cache_symbols[
+        xa_cache_symbol_hash(instance, entry->symbol_name, entry->pid)];
+    while (*link != entry){
+        link = &(*link)->symbol_next;
     }
+    *link = entry->symbol_next;
+    xa_cache_virt_remove(instance, entry);
+    xa_cache_unlink(instance, entry);
 
-    /* do we need to remove anything from the cache? */
-    if (instance->current_cache_size >= XA_CACHE_SIZE){
-        xa_cache_entry_t oldest = instance->cache_head;
-        xa_cache_entry_t current = instance->cache_head;
-
-        /* find the least recently used entry */
-        while (current != NULL){
-            if (current->last_used < oldest->last_used){
-                oldest = current;
-            }
-            current = current->next;
-        }
+    xa_dbprint("--Cache evict (%s)\n", entry->symbol_name);
+    free(entry->symbol_name);
+    free(entry);
+    instance->current_cache_size--;
+}
 
-        /* remove that entry */
-        if (NULL == oldest->next && NULL == oldest->prev){  /* only entry */
-            instance->cache_head = NULL;
-            instance->cache_tail = NULL;
-        }
-        else if (NULL == oldest->next){  /* last entry */
-            instance->cache_tail = oldest->prev;
-            oldest->prev->next = NULL;
-        }
-        else if (NULL == oldest->prev){  /* first entry */
-            instance->cache_head = oldest->next;
-            oldest->next->prev = NULL;
-        }
-        else{  /* somewhere in the middle */
-            oldest->prev->next = oldest->next;
-            oldest->next->prev = oldest->prev;
+/* evicts the least recently used entries until at most size remain */
+static void xa_cache_shrink (xa_instance_t *instance, uint32_t size)
+{
+    while (NULL != instance->cache_head &&
+           instance->current_cache_size > size){
+        instance->stats.symbol_evictions++;
+        xa_cache_remove(instance, instance->cache_head);
+    }
+}
+
+static xa_cache_entry_t xa_cache_find_sym (
+    xa_instance_t *instance, char *symbol_name, int pid)
+{
+    xa_cache_entry_t current = NULL;
+
+    if (NULL == instance->cache_symbols){
+        return NULL;
+    }
+    current = instance->cache_symbols[
+        xa_cache_symbol_hash(instance, symbol_name, pid)];
+    while (current != NULL){
+        if (current->pid == pid &&
+            strncmp(current->symbol_name, symbol_name, MAX_SYM_LEN) == 0){
+            break;
         }
+        current = current->symbol_next;
+    }
+    return current;
+}
+
+static xa_cache_entry_t xa_cache_find_virt (
+    xa_instance_t *instance, xa_addr_t virt_address, int pid)
+{
+    xa_cache_entry_t current = NULL;
 
-        /* free up memory */
-        if (oldest->symbol_name){
-            free(oldest->symbol_name);
+    if (NULL == instance->cache_virt){
+        return NULL;
+    }
+    current = instance->cache_virt[
+        xa_cache_virt_hash(instance, virt_address, pid)];
+    while (current != NULL){
+        if (current->virt_address == virt_address && current->pid == pid){
+            break;
         }
-        oldest->next = NULL;
-        oldest->prev = NULL;
-        free(oldest);
+        current = current->virt_next;
+    }
+    return current;
+}
 
-        instance->current_cache_size--;
+int xa_check_cache_sym (xa_instance_t *instance,
+                        char *symbol_name,
+                        int pid,
+                        uint64_t *mach_address)
+{
+    xa_cache_entry_t entry = xa_cache_find_sym(instance, symbol_name, pid);
+
+    if (NULL == entry || !entry->mach_address){
+        instance->stats.symbol_misses++;
+        return 0;
     }
+    instance->stats.symbol_hits++;
+    xa_cache_touch(instance, entry);
+    *mach_address = entry->mach_address;
+    xa_dbprint("++Cache hit (%s --> 0x%.8llx)\n",
+        symbol_name, *mach_address);
+    return 1;
+}
 
-    /* allocate memory for the new cache entry */
-    new_entry = (xa_cache_entry_t) malloc(sizeof(struct xa_cache_entry));
-    new_entry->last_used = time(NULL);
-    if (symbol_name){
-        new_entry->symbol_name = strndup(symbol_name, MAX_SYM_LEN);
-        new_entry->virt_address = 0;
-        if (mach_address){
-            new_entry->mach_address = mach_address;
+int xa_update_cache (xa_instance_t *instance,
+                     char *symbol_name,
+                     xa_addr_t virt_address,
+                     int pid,
+                     uint64_t mach_address)
+{
+    xa_cache_entry_t entry = NULL;
+    xa_cache_entry_t alias = NULL;
+    uint32_t bucket = 0;
+
+    /* is cache enabled? was this a spurious call with bad info? */
+    if (0 == instance->cache_size || !symbol_name){
+        return 1;
+    }
+
+    /* allocate the hash tables on first use */
+    if (NULL == instance->cache_symbols &&
+        xa_cache_rehash(instance, xa_cache_bucket_count(
+            instance->cache_size, XA_CACHE_BUCKETS)) == XA_FAILURE){
+        return 1;
+    }
+
+    /* a symbol at an address that is already cached needs no walk */
+    if (!mach_address){
+        alias = xa_cache_find_virt(instance, virt_address, pid);
+        if (NULL != alias){
+            instance->stats.virt_hits++;
+            mach_address = alias->mach_address;
         }
         else{
-            new_entry->mach_address =
-                xa_translate_kv2p(instance, virt_address);
+            instance->stats.virt_misses++;
+            mach_address = xa_translate_kv2p(instance, virt_address);
         }
-        xa_dbprint("++Cache set (%s --> 0x%.8x)\n",
-            symbol_name, new_entry->mach_address);
     }
-    else{
-        new_entry->symbol_name = strndup("", MAX_SYM_LEN);
-        new_entry->virt_address = vlookup;
-        new_entry->mach_address = mlookup;
-        xa_dbprint("++Cache set (0x%.8x --> 0x%.8x)\n", vlookup, mlookup);
+
+    /* does anything match the passed symbol_name? */
+    /* if so, update that entry */
+    entry = xa_cache_find_sym(instance, symbol_name, pid);
+    if (NULL != entry){
+        xa_cache_virt_remove(instance, entry);
+        entry->virt_address = virt_address;
+        entry->mach_address = mach_address;
+        xa_cache_virt_insert(instance, entry);
+        xa_cache_touch(instance, entry);
+        xa_dbprint("++Cache update (%s --> 0x%.8llx)\n",
+            symbol_name, mach_address);
+        return 1;
     }
-    new_entry->pid = pid;
 
-    /* add it to the end of the list */
-    if (NULL != instance->cache_tail){
-        instance->cache_tail->next = new_entry;
+    /* make room by dropping the least recently used entry */
+    xa_cache_shrink(instance, instance->cache_size - 1);
+
+    /* allocate memory for the new cache entry */
+    entry = (xa_cache_entry_t) malloc(sizeof(struct xa_cache_entry));
+    if (NULL == entry){
+        return 1;
     }
-    new_entry->prev = instance->cache_tail;
-    instance->cache_tail = new_entry;
-    if (NULL == instance->cache_head){
-        instance->cache_head = new_entry;
+    entry->symbol_name = strndup(symbol_name, MAX_SYM_LEN);
+    if (NULL == entry->symbol_name){
+        free(entry);
+        return 1;
     }
-    new_entry->next = NULL;
-    instance->current_cache_size++;
+    entry->virt_address = virt_address;
+    entry->mach_address = mach_address;
+    entry->pid = pid;
+    xa_dbprint("++Cache set (%s --> 0x%.8llx)\n",
+        symbol_name, entry->mach_address);
 
-exit:
+    bucket = xa_cache_symbol_hash(instance, symbol_name, pid);
+    entry->symbol_next = instance->cache_symbols[bucket];
+    instance->cache_symbols[bucket] = entry;
+    xa_cache_virt_insert(instance, entry);
+    xa_cache_append(instance, entry);
+    instance->current_cache_size++;
     return 1;
 }
 
@@ -246,60 +337,177 @@ int xa_destroy_cache (xa_instance_t *instance)
     xa_cache_entry_t tmp = NULL;
     while (current != NULL){
         tmp = current->next;
+        free(current->symbol_name);
         free(current);
         current = tmp;
     }
+    free(instance->cache_symbols);
+    free(instance->cache_virt);
 
+    instance->cache_symbols = NULL;
+    instance->cache_virt = NULL;
+    instance->cache_bucket_count = 0;
     instance->cache_head = NULL;
     instance->cache_tail = NULL;
     instance->current_cache_size = 0;
     return 0;
 }
 
+int xa_set_cache_size (xa_instance_t *instance, uint32_t size)
+{
+    uint32_t buckets = xa_cache_bucket_count(size, XA_CACHE_BUCKETS);
+
+    instance->cache_size = size;
+    xa_cache_shrink(instance, size);
+
+    /* keep the chains short for the new size */
+    if (NULL != instance->cache_symbols &&
+        buckets != instance->cache_bucket_count &&
+        xa_cache_rehash(instance, buckets) == XA_FAILURE){
+        return XA_FAILURE;
+    }
+    xa_dbprint("**set instance->cache_size = %d\n", size);
+    return XA_SUCCESS;
+}
+
 /* ========================================================= */
 /*     Cache implementation for PID to PGD cache below.      */
 /* ========================================================= */
 
+static uint32_t xa_pid_cache_hash (xa_instance_t *instance, int pid)
+{
+    uint32_t hash = (uint32_t) pid * 0x9e3779b1;
+    return (hash ^ (hash >> 16)) & (instance->pid_cache_bucket_count - 1);
+}
+
+/* moves every entry into a new table with the given number of buckets */
+static int xa_pid_cache_rehash (xa_instance_t *instance, uint32_t buckets)
+{
+    xa_pid_cache_entry_t *table = NULL;
+    xa_pid_cache_entry_t current = NULL;
+
+    table = calloc(buckets, sizeof(xa_pid_cache_entry_t));
+    if (NULL == table){
+        return XA_FAILURE;
+    }
+    free(instance->pid_cache_buckets);
+    instance->pid_cache_buckets = table;
+    instance->pid_cache_bucket_count = buckets;
+
+    for (current = instance->pid_cache_head; NULL != current;
+         current = current->next){
+        uint32_t bucket = xa_pid_cache_hash(instance, current->pid);
+        current->hash_next = table[bucket];
+        table[bucket] = current;
+    }
+    return XA_SUCCESS;
+}
+
+static void xa_remove_pid_cache_entry (
+    xa_instance_t *instance, xa_pid_cache_entry_t entry)
+{
+    xa_pid_cache_entry_t *link =
+        &instance->pid_cache_buckets[xa_pid_cache_hash(instance, entry->pid)];
+
+    /* remove from the hash chain */
+    while (*link != entry){
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+
+    /* remove from the LRU list */
+    if (NULL != entry->prev){
+        entry->prev->next = entry->next;
+    }
+    else{
+        instance->pid_cache_head = entry->next;
+    }
+    if (NULL != entry->next){
+        entry->next->prev = entry->prev;
+    }
+    else{
+        instance->pid_cache_tail = entry->prev;
+    }
+
+    free(entry);
+    instance->current_pid_cache_size--;
+}
+
+/* evicts the least recently used entries until at most size remain */
+static void xa_pid_cache_shrink (xa_instance_t *instance, uint32_t size)
+{
+    while (NULL != instance->pid_cache_head &&
+           instance->current_pid_cache_size > size){
+        instance->stats.pid_evictions++;
+        xa_remove_pid_cache_entry(instance, instance->pid_cache_head);
+    }
+}
+
+/* finds the entry for pid and moves it to the most recently used end */
 xa_pid_cache_entry_t xa_check_pid_cache_helper (
     xa_instance_t *instance, int pid)
 {
-    xa_pid_cache_entry_t current = instance->pid_cache_head;
-    while (current != NULL){
-        if (current->pid == pid){
-            current->last_used = time(NULL);
-            goto exit;
-        }
-        current = current->next;
+    xa_pid_cache_entry_t current = NULL;
+
+    if (NULL == instance->pid_cache_buckets){
+        return NULL;
+    }
+    current = instance->pid_cache_buckets[xa_pid_cache_hash(instance, pid)];
+    while (current != NULL && current->pid != pid){
+        current = current->hash_next;
     }
+    if (current != NULL && instance->pid_cache_tail != current){
+        if (NULL != current->prev){
+            current->prev->next = current->next;
+        }
+        else{
+            instance->pid_cache_head = current->next;
+        }
+        current->next->prev = current->prev;
 
-exit:
+        current->prev = instance->pid_cache_tail;
+        current->next = NULL;
+        instance->pid_cache_tail->next = current;
+        instance->pid_cache_tail = current;
+    }
     return current;
 }
 
-int xa_check_pid_cache (xa_instance_t *instance, int pid, uint32_t *pgd)
+int xa_check_pid_cache (xa_instance_t *instance, int pid, uint64_t *pgd)
 {
     xa_pid_cache_entry_t search;
     int ret = 0;
 
     /* if found, set ret to 1 and put answer in *pgd */
     search = xa_check_pid_cache_helper(instance, pid);
+
+    /* a changed page directory may belong to another process now */
+    if (search != NULL && !xa_watch_valid(instance, search->tag)){
+        xa_dbprint("--PID Cache stale (%d)\n", pid);
+        xa_remove_pid_cache_entry(instance, search);
+        search = NULL;
+    }
     if (search != NULL){
+        instance->stats.pid_hits++;
         *pgd = search->pgd;
         ret = 1;
-        xa_dbprint("++PID Cache hit (%d --> 0x%.8x)\n", pid, *pgd);
+        xa_dbprint("++PID Cache hit (%d --> 0x%.8llx)\n", pid, *pgd);
+    }
+    else{
+        instance->stats.pid_misses++;
     }
 
-exit:
     return ret;
 }
 
-int xa_update_pid_cache (xa_instance_t *instance, int pid, uint32_t pgd)
+int xa_update_pid_cache (xa_instance_t *instance, int pid, uint64_t pgd)
 {
     xa_pid_cache_entry_t search = NULL;
     xa_pid_cache_entry_t new_entry = NULL;
+    uint32_t bucket = 0;
 
     /* is cache enabled? */
-    if (XA_PID_CACHE_SIZE == 0){
+    if (0 == instance->pid_cache_size){
         return 1;
     }
 
@@ -308,60 +516,39 @@ int xa_update_pid_cache (xa_instance_t *instance, int pid, uint32_t pgd)
         goto exit;
     }
 
+    /* allocate the hash table on first use */
+    if (NULL == instance->pid_cache_buckets &&
+        xa_pid_cache_rehash(instance, xa_cache_bucket_count(
+            instance->pid_cache_size, XA_PID_CACHE_BUCKETS)) == XA_FAILURE){
+        goto exit;
+    }
+
     /* does anything match the passed pid? */
     /* if so, update that entry */
     search = xa_check_pid_cache_helper(instance, pid);
     if (search != NULL){
         search->pgd = pgd;
-        xa_dbprint("++PID Cache update (%d --> 0x%.8x)\n", pid, pgd);
+        search->tag = xa_watch_page(instance, pgd >> instance->page_shift);
+        xa_dbprint("++PID Cache update (%d --> 0x%.8llx)\n", pid, pgd);
         goto exit;
     }
 
-    /* do we need to remove anything from the cache? */
-    if (instance->current_pid_cache_size >= XA_PID_CACHE_SIZE){
-        xa_pid_cache_entry_t oldest = instance->pid_cache_head;
-        xa_pid_cache_entry_t current = instance->pid_cache_head;
-
-        /* find the least recently used entry */
-        while (current != NULL){
-            if (current->last_used < oldest->last_used){
-                oldest = current;
-            }
-            current = current->next;
-        }
-
-        /* remove that entry */
-        if (NULL == oldest->next && NULL == oldest->prev){  /* only entry */
-            instance->pid_cache_head = NULL;
-            instance->pid_cache_tail = NULL;
-        }
-        else if (NULL == oldest->next){  /* last entry */
-            instance->pid_cache_tail = oldest->prev;
-            oldest->prev->next = NULL;
-        }
-        else if (NULL == oldest->prev){  /* first entry */
-            instance->pid_cache_head = oldest->next;
-            oldest->next->prev = NULL;
-        }
-        else{  /* somewhere in the middle */
-            oldest->prev->next = oldest->next;
-            oldest->next->prev = oldest->prev;
-        }
-
-        /* free up memory */
-        oldest->next = NULL;
-        oldest->prev = NULL;
-        free(oldest);
-
-        instance->current_pid_cache_size--;
-    }
+    /* make room by dropping the least recently used entry */
+    xa_pid_cache_shrink(instance, instance->pid_cache_size - 1);
 
     /* allocate memory for the new cache entry */
     new_entry = (xa_pid_cache_entry_t)malloc(sizeof(struct xa_pid_cache_entry));
-    new_entry->last_used = time(NULL);
+    if (NULL == new_entry){
+        goto exit;
+    }
     new_entry->pid = pid;
     new_entry->pgd = pgd;
-    xa_dbprint("++PID Cache set (%d --> 0x%.8x)\n", pid, pgd);
+    new_entry->tag = xa_watch_page(instance, pgd >> instance->page_shift);
+    xa_dbprint("++PID Cache set (%d --> 0x%.8llx)\n", pid, pgd);
+
+    bucket = xa_pid_cache_hash(instance, pid);
+    new_entry->hash_next = instance->pid_cache_buckets[bucket];
+    instance->pid_cache_buckets[bucket] = new_entry;
 
     /* add it to the end of the list */
     if (NULL != instance->pid_cache_tail){
@@ -388,9 +575,827 @@ int xa_destroy_pid_cache (xa_instance_t *instance)
         free(current);
         current = tmp;
     }
+    free(instance->pid_cache_buckets);
 
+    instance->pid_cache_buckets = NULL;
+    instance->pid_cache_bucket_count = 0;
     instance->pid_cache_head = NULL;
     instance->pid_cache_tail = NULL;
     instance->current_pid_cache_size = 0;
     return 0;
 }
+
+int xa_set_pid_cache_size (xa_instance_t *instance, uint32_t size)
+{
+    uint32_t buckets = xa_cache_bucket_count(size, XA_PID_CACHE_BUCKETS);
+
+    instance->pid_cache_size = size;
+    xa_pid_cache_shrink(instance, size);
+
+    /* keep the chains short for the new size */
+    if (NULL != instance->pid_cache_buckets &&
+        buckets != instance->pid_cache_bucket_count &&
+        xa_pid_cache_rehash(instance, buckets) == XA_FAILURE){
+        return XA_FAILURE;
+    }
+    xa_dbprint("**set instance->pid_cache_size = %d\n", size);
+    return XA_SUCCESS;
+}
+
+void xa_flush_cache (xa_instance_t *instance)
+{
+    xa_destroy_cache(instance);
+    xa_destroy_pid_cache(instance);
+    xa_dbprint("--Cache flush\n");
+}
+
+/* ========================================================= */
+/*     Change detection for paging structure pages.          */
+/* ========================================================= */
+
+/* generations are kept to the bits above the slot in a tag */
+#define XA_PT_WATCH_GEN_MASK ((1U << (32 - XA_PT_WATCH_SHIFT)) - 1)
+
+/* first slot of the set that a frame can be watched in */
+static uint32_t xa_pt_watch_set (uint64_t frame)
+{
+    return ((uint32_t) (frame ^ (frame >> XA_PT_WATCH_SHIFT)) &
+        (XA_PT_WATCH_SIZE / XA_PT_WATCH_WAYS - 1)) * XA_PT_WATCH_WAYS;
+}
+
+/* hashes the current contents of a page, 64 bits at a time */
+static int xa_pt_watch_hash (
+    xa_instance_t *instance, uint64_t frame, uint64_t *hash)
+{
+    uint32_t offset = 0;
+    uint64_t *words = NULL;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    uint64_t mask = ~0x60ULL;
+    uint32_t i = 0;
+
+    /* the CPU sets the accessed and dirty bits all the time, and they
+       don't change a translation; non-PAE has two entries per word */
+    if (!instance->pae && !instance->ia32e){
+        mask = ~0x6000000060ULL;
+    }
+
+    words = xa_access_ma(instance, frame << instance->page_shift,
+        &offset, PROT_READ);
+    if (NULL == words){
+        return XA_FAILURE;
+    }
+    for (i = 0; i < instance->page_size / sizeof(uint64_t); ++i){
+        h = (h ^ (words[i] & mask)) * 0x100000001b3ULL;
+    }
+    xa_munmap(instance, words, instance->page_size);
+    *hash = h;
+    return XA_SUCCESS;
+}
+
+/* starts a new generation so that the old tags for a slot are invalid;
+   the last generation is skipped so no tag equals XA_PT_WATCH_FAILED */
+static void xa_pt_watch_bump (xa_pt_watch_entry_t entry)
+{
+    entry->generation++;
+    if (entry->generation >= XA_PT_WATCH_GEN_MASK){
+        entry->generation = 1;
+    }
+}
+
+uint32_t xa_watch_page (xa_instance_t *instance, uint64_t frame)
+{
+    uint32_t base = xa_pt_watch_set(frame);
+    xa_pt_watch_entry_t set = NULL;
+    xa_pt_watch_entry_t victim = NULL;
+    uint64_t hash = 0;
+    uint32_t i = 0;
+
+    if (NULL == instance->pt_watch){
+        instance->pt_watch = calloc(
+            XA_PT_WATCH_SIZE, sizeof(struct xa_pt_watch_entry));
+        if (NULL == instance->pt_watch){
+            return XA_PT_WATCH_FAILED;
+        }
+    }
+
+    /* a page that is already watched keeps its hash; otherwise take a
+       free way, or the least recently used one if the set is full */
+    set = instance->pt_watch + base;
+    for (i = 0; i < XA_PT_WATCH_WAYS; ++i){
+        if (set[i].generation && set[i].frame == frame){
+            set[i].last_used = ++instance->pt_watch_clock;
+            return (set[i].generation << XA_PT_WATCH_SHIFT) | (base + i);
+        }
+        if (NULL == victim ||
+            (victim->generation && (0 == set[i].generation ||
+                set[i].last_used < victim->last_used))){
+            victim = &set[i];
+        }
+    }
+
+    /* taking over a way drops whatever depended on the old page */
+    if (xa_pt_watch_hash(instance, frame, &hash) == XA_FAILURE){
+        return XA_PT_WATCH_FAILED;
+    }
+    victim->frame = frame;
+    victim->hash = hash;
+    victim->last_used = ++instance->pt_watch_clock;
+    xa_pt_watch_bump(victim);
+    return (victim->generation << XA_PT_WATCH_SHIFT) |
+        (uint32_t) (victim - instance->pt_watch);
+}
+
+int xa_watch_valid (xa_instance_t *instance, uint32_t tag)
+{
+    if (0 == tag){
+        return 1;
+    }
+    if (XA_PT_WATCH_FAILED == tag || NULL == instance->pt_watch){
+        return 0;
+    }
+    return instance->pt_watch[tag & (XA_PT_WATCH_SIZE - 1)].generation ==
+        (tag >> XA_PT_WATCH_SHIFT);
+}
+
+uint32_t xa_invalidate (xa_instance_t *instance)
+{
+    uint32_t changed = 0;
+    uint64_t hash = 0;
+    uint32_t i = 0;
+
+    if (NULL == instance->pt_watch){
+        return 0;
+    }
+    for (i = 0; i < XA_PT_WATCH_SIZE; ++i){
+        xa_pt_watch_entry_t entry = &instance->pt_watch[i];
+        if (0 == entry->generation){
+            continue;
+        }
+
+        /* a page that can't be read any more is treated as changed */
+        if (xa_pt_watch_hash(instance, entry->frame, &hash) == XA_FAILURE){
+            hash = ~entry->hash;
+        }
+        if (hash != entry->hash){
+            entry->hash = hash;
+            xa_pt_watch_bump(entry);
+            changed++;
+        }
+    }
+    xa_dbprint("--Invalidate: %u paging pages changed\n", changed);
+    return changed;
+}
+
+void xa_destroy_pt_watch (xa_instance_t *instance)
+{
+    free(instance->pt_watch);
+    instance->pt_watch = NULL;
+    instance->pt_watch_clock = 0;
+    instance->invalidate_count = 0;
+}
+
+int xa_set_invalidate_epoch (xa_instance_t *instance, uint32_t lookups)
+{
+    instance->invalidate_epoch = lookups;
+    instance->invalidate_count = 0;
+    xa_dbprint("**set instance->invalidate_epoch = %u\n", lookups);
+    return XA_SUCCESS;
+}
+
+/* ========================================================= */
+/*     Software TLB for virtual to machine translations.     */
+/* ========================================================= */
+
+/* picks the set for a virtual page of the given size in an address space */
+static uint32_t xa_tlb_set (
+    xa_instance_t *instance, xa_addr_t vpage, int pid, uint32_t page_shift)
+{
+    uint32_t hash = (uint32_t) (vpage ^ (vpage >> 32)) ^
+        ((uint32_t) pid * 0x9e3779b1) ^ page_shift;
+    return (hash ^ (hash >> 16)) & (instance->tlb_sets - 1);
+}
+
+/* returns the entry holding the translation for vaddr using pages of
+   the given size, or NULL */
+static xa_tlb_entry_t xa_tlb_probe (
+    xa_instance_t *instance, xa_addr_t vaddr, int pid, uint32_t page_shift)
+{
+    xa_addr_t vpage = vaddr >> page_shift;
+    xa_tlb_entry_t set = instance->tlb +
+        xa_tlb_set(instance, vpage, pid, page_shift) * XA_TLB_WAYS;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    for (i = 0; i < XA_TLB_WAYS; ++i){
+        if (set[i].page_shift == page_shift &&
+            set[i].vpage == vpage &&
+            set[i].pid == pid){
+            break;
+        }
+    }
+    if (XA_TLB_WAYS == i){
+        return NULL;
+    }
+
+    /* drop the entry if a page table it came from has changed */
+    for (j = 0; j < XA_PT_LEVELS; ++j){
+        if (!xa_watch_valid(instance, set[i].tags[j])){
+            xa_dbprint("--TLB stale (0x%.8llx)\n", vaddr);
+            memset(&set[i], 0, sizeof(struct xa_tlb_entry));
+            return NULL;
+        }
+    }
+    return &set[i];
+}
+
+int xa_check_tlb (xa_instance_t *instance,
+                  xa_addr_t virt_address,
+                  int pid,
+                  uint64_t *mach_address)
+{
+    xa_tlb_entry_t entry = NULL;
+
+    if (NULL == instance->tlb){
+        return 0;
+    }
+
+    /* look for changed page tables every epoch */
+    if (instance->invalidate_epoch &&
+        ++instance->invalidate_count >= instance->invalidate_epoch){
+        instance->invalidate_count = 0;
+        xa_invalidate(instance);
+    }
+
+    /* the large page sizes depend on the paging mode */
+    entry = xa_tlb_probe(instance, virt_address, pid, 12);
+    if (NULL == entry){
+        entry = xa_tlb_probe(instance, virt_address, pid,
+            (instance->pae || instance->ia32e) ? 21 : 22);
+    }
+    if (NULL == entry && instance->ia32e){
+        entry = xa_tlb_probe(instance, virt_address, pid, 30);
+    }
+    if (NULL == entry){
+        instance->tlb_misses++;
+        return 0;
+    }
+
+    entry->last_used = ++instance->tlb_clock;
+    instance->tlb_hits++;
+    *mach_address = entry->mach_address |
+        (virt_address & ((1ULL << entry->page_shift) - 1));
+    xa_dbprint("++TLB hit (0x%.8llx --> 0x%.8llx)\n",
+        virt_address, *mach_address);
+    return 1;
+}
+
+int xa_update_tlb (xa_instance_t *instance,
+                   xa_addr_t virt_address,
+                   int pid,
+                   uint64_t mach_address,
+                   uint32_t page_shift,
+                   const uint32_t *tags)
+{
+    xa_addr_t vpage = virt_address >> page_shift;
+    xa_tlb_entry_t set = NULL;
+    xa_tlb_entry_t victim = NULL;
+    uint32_t i = 0;
+
+    /* is the TLB enabled? */
+    if (0 == instance->tlb_size){
+        return 0;
+    }
+
+    /* allocate the entries on first use */
+    if (NULL == instance->tlb){
+        instance->tlb_sets = instance->tlb_size / XA_TLB_WAYS;
+        instance->tlb = calloc(instance->tlb_size, sizeof(struct xa_tlb_entry));
+        if (NULL == instance->tlb){
+            return 0;
+        }
+    }
+
+    /* reuse the entry for this page if it is here, else replace the
+       least recently used entry in the set */
+    set = instance->tlb +
+        xa_tlb_set(instance, vpage, pid, page_shift) * XA_TLB_WAYS;
+    for (i = 0; i < XA_TLB_WAYS; ++i){
+        if (set[i].page_shift == page_shift &&
+            set[i].vpage == vpage &&
+            set[i].pid == pid){
+            victim = &set[i];
+            break;
+        }
+        if (NULL == victim || set[i].last_used < victim->last_used){
+            victim = &set[i];
+        }
+    }
+
+    victim->vpage = vpage;
+    victim->page_shift = page_shift;
+    victim->pid = pid;
+    victim->mach_address = mach_address & ~((1ULL << page_shift) - 1);
+    victim->last_used = ++instance->tlb_clock;
+    if (NULL != tags){
+        memcpy(victim->tags, tags, sizeof(victim->tags));
+    }
+    else{
+        memset(victim->tags, 0, sizeof(victim->tags));
+    }
+    xa_dbprint("++TLB set (0x%.8llx --> 0x%.8llx, %d bit page)\n",
+        vpage << page_shift, victim->mach_address, page_shift);
+    return 1;
+}
+
+int xa_destroy_tlb (xa_instance_t *instance)
+{
+    free(instance->tlb);
+    free(instance->pde_cache);
+    free(instance->neg_cache);
+    instance->tlb = NULL;
+    instance->pde_cache = NULL;
+    instance->neg_cache = NULL;
+    instance->tlb_sets = 0;
+    instance->tlb_clock = 0;
+    return 0;
+}
+
+void xa_flush_tlb (xa_instance_t *instance)
+{
+    if (NULL != instance->tlb){
+        memset(instance->tlb, 0,
+            instance->tlb_size * sizeof(struct xa_tlb_entry));
+    }
+    if (NULL != instance->pde_cache){
+        memset(instance->pde_cache, 0,
+            XA_PDE_CACHE_SIZE * sizeof(struct xa_pde_cache_entry));
+    }
+    if (NULL != instance->neg_cache){
+        memset(instance->neg_cache, 0,
+            XA_NEG_CACHE_SIZE * sizeof(struct xa_neg_cache_entry));
+    }
+    xa_dbprint("--TLB flush\n");
+}
+
+/* ========================================================= */
+/*     Paging-structure cache for page directory entries.    */
+/* ========================================================= */
+
+/* direct mapped on the entry address, entries are 4 or 8 bytes */
+static uint32_t xa_pde_cache_index (uint64_t entry_address)
+{
+    return ((entry_address >> 2) ^ (entry_address >> 12)) &
+        (XA_PDE_CACHE_SIZE - 1);
+}
+
+int xa_check_pde_cache (
+    xa_instance_t *instance, uint64_t entry_address, uint64_t *value)
+{
+    xa_pde_cache_entry_t entry = NULL;
+
+    if (NULL == instance->pde_cache || 0 == instance->tlb_size){
+        return 0;
+    }
+    entry = &instance->pde_cache[xa_pde_cache_index(entry_address)];
+    if (0 == entry->value || entry->entry_address != entry_address){
+        return 0;
+    }
+    if (!xa_watch_valid(instance, entry->tag)){
+        entry->value = 0;
+        return 0;
+    }
+    *value = entry->value;
+    return 1;
+}
+
+void xa_update_pde_cache (
+    xa_instance_t *instance, uint64_t entry_address, uint64_t value)
+{
+    xa_pde_cache_entry_t entry = NULL;
+
+    /* the TLB size also turns this cache on and off */
+    if (0 == instance->tlb_size){
+        return;
+    }
+    if (NULL == instance->pde_cache){
+        instance->pde_cache = calloc(
+            XA_PDE_CACHE_SIZE, sizeof(struct xa_pde_cache_entry));
+        if (NULL == instance->pde_cache){
+            return;
+        }
+    }
+    entry = &instance->pde_cache[xa_pde_cache_index(entry_address)];
+    entry->entry_address = entry_address;
+    entry->value = value;
+    entry->tag = xa_watch_page(instance, entry_address >> instance->page_shift);
+}
+
+/* ========================================================= */
+/*     Negative cache for unmapped virtual addresses.        */
+/* ========================================================= */
+
+/* direct mapped on the region, like the TLB sets */
+static uint32_t xa_neg_cache_index (
+    xa_addr_t vpage, int pid, uint32_t page_shift)
+{
+    uint32_t hash = (uint32_t) (vpage ^ (vpage >> 32)) ^
+        ((uint32_t) pid * 0x9e3779b1) ^ page_shift;
+    return (hash ^ (hash >> 16)) & (XA_NEG_CACHE_SIZE - 1);
+}
+
+static int xa_neg_cache_probe (
+    xa_instance_t *instance, xa_addr_t virt_address, int pid,
+    uint32_t page_shift)
+{
+    xa_addr_t vpage = virt_address >> page_shift;
+    xa_neg_cache_entry_t entry = &instance->neg_cache[
+        xa_neg_cache_index(vpage, pid, page_shift)];
+    uint32_t i = 0;
+
+    if (entry->page_shift != page_shift ||
+        entry->vpage != vpage ||
+        entry->pid != pid){
+        return 0;
+    }
+
+    /* holes get filled in, so entries only last for a while */
+    if ((int32_t) (entry->expires - instance->neg_clock) <= 0){
+        entry->page_shift = 0;
+        return 0;
+    }
+    for (i = 0; i < XA_PT_LEVELS; ++i){
+        if (!xa_watch_valid(instance, entry->tags[i])){
+            entry->page_shift = 0;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int xa_check_neg_cache (
+    xa_instance_t *instance, xa_addr_t virt_address, int pid)
+{
+    int hit = 0;
+
+    if (NULL == instance->neg_cache || 0 == instance->tlb_size){
+        return 0;
+    }
+    instance->neg_clock++;
+
+    /* the hole may be a page or anything a missing entry leaves */
+    hit = xa_neg_cache_probe(instance, virt_address, pid, 12);
+    if (!hit){
+        hit = xa_neg_cache_probe(instance, virt_address, pid,
+            (instance->pae || instance->ia32e) ? 21 : 22);
+    }
+    if (!hit && (instance->pae || instance->ia32e)){
+        hit = xa_neg_cache_probe(instance, virt_address, pid, 30);
+    }
+    if (!hit && instance->ia32e){
+        hit = xa_neg_cache_probe(instance, virt_address, pid, 39);
+    }
+    if (hit){
+        instance->stats.negative_hits++;
+        xa_dbprint("++Negative cache hit (0x%.8llx)\n", virt_address);
+    }
+    return hit;
+}
+
+void xa_update_neg_cache (
+    xa_instance_t *instance, xa_addr_t virt_address, int pid,
+    uint32_t page_shift, const uint32_t *tags)
+{
+    xa_addr_t vpage = virt_address >> page_shift;
+    xa_neg_cache_entry_t entry = NULL;
+
+    /* the TLB size also turns this cache on and off */
+    if (0 == instance->tlb_size){
+        return;
+    }
+    if (NULL == instance->neg_cache){
+        instance->neg_cache = calloc(
+            XA_NEG_CACHE_SIZE, sizeof(struct xa_neg_cache_entry));
+        if (NULL == instance->neg_cache){
+            return;
+        }
+    }
+    entry = &instance->neg_cache[xa_neg_cache_index(vpage, pid, page_shift)];
+    entry->vpage = vpage;
+    entry->page_shift = page_shift;
+    entry->pid = pid;
+    entry->expires = instance->neg_clock + XA_NEG_CACHE_LIFETIME;
+    if (NULL != tags){
+        memcpy(entry->tags, tags, sizeof(entry->tags));
+    }
+    else{
+        memset(entry->tags, 0, sizeof(entry->tags));
+    }
+    xa_dbprint("++Negative cache set (0x%.8llx, %d bit region)\n",
+        vpage << page_shift, page_shift);
+}
+
+int xa_set_tlb_size (xa_instance_t *instance, uint32_t size)
+{
+    uint32_t sets = 1;
+
+    /* round down to a power of two number of sets */
+    if (size >= XA_TLB_WAYS){
+        while (sets * 2 <= size / XA_TLB_WAYS){
+            sets *= 2;
+        }
+        size = sets * XA_TLB_WAYS;
+    }
+    else{
+        size = 0;
+    }
+
+    /* the entries are reallocated at the new size on next use */
+    xa_destroy_tlb(instance);
+    instance->tlb_size = size;
+    xa_dbprint("**set instance->tlb_size = %d\n", size);
+    return XA_SUCCESS;
+}
+
+void xa_get_tlb_stats (
+    xa_instance_t *instance, uint32_t *hits, uint32_t *misses)
+{
+    if (NULL != hits){
+        *hits = instance->tlb_hits;
+    }
+    if (NULL != misses){
+        *misses = instance->tlb_misses;
+    }
+}
+
+void xa_get_stats (xa_instance_t *instance, xa_stats_t *stats)
+{
+    *stats = instance->stats;
+    stats->tlb_hits = instance->tlb_hits;
+    stats->tlb_misses = instance->tlb_misses;
+    stats->page_cache_hits = instance->page_cache_hits;
+    stats->page_cache_misses = instance->page_cache_misses;
+}
+
+void xa_reset_stats (xa_instance_t *instance)
+{
+    memset(&instance->stats, 0, sizeof(xa_stats_t));
+    instance->tlb_hits = 0;
+    instance->tlb_misses = 0;
+    instance->page_cache_hits = 0;
+    instance->page_cache_misses = 0;
+}
+
+/* ========================================================= */
+/*     Cache implementation for mapped guest pages below.    */
+/* ========================================================= */
+
+static uint32_t xa_page_cache_frame_hash (unsigned long frame_num)
+{
+    return frame_num & (XA_PAGE_CACHE_BUCKETS - 1);
+}
+
+static uint32_t xa_page_cache_memory_hash (
+    xa_instance_t *instance, void *memory)
+{
+    return ((unsigned long) memory >> instance->page_shift) &
+        (XA_PAGE_CACHE_BUCKETS - 1);
+}
+
+/* moves an entry to the most recently used end of the list */
+static void xa_page_cache_touch (
+    xa_instance_t *instance, xa_page_cache_entry_t entry)
+{
+    if (instance->page_cache_tail == entry){
+        return;
+    }
+
+    /* unlink it */
+    if (NULL != entry->prev){
+        entry->prev->next = entry->next;
+    }
+    else{
+        instance->page_cache_head = entry->next;
+    }
+    entry->next->prev = entry->prev;
+
+    /* and put it back at the end */
+    entry->prev = instance->page_cache_tail;
+    entry->next = NULL;
+    instance->page_cache_tail->next = entry;
+    instance->page_cache_tail = entry;
+}
+
+/* unmaps and frees an entry, which must not be in use */
+static void xa_page_cache_remove (
+    xa_instance_t *instance, xa_page_cache_entry_t entry)
+{
+    xa_page_cache_entry_t *link = NULL;
+
+    /* remove from the frame hash chain */
+    link = &instance->page_cache_frames[
+        xa_page_cache_frame_hash(entry->frame_num)];
+    while (*link != entry){
+        link = &(*link)->frame_next;
+    }
+    *link = entry->frame_next;
+
+    /* remove from the memory hash chain */
+    link = &instance->page_cache_memory[
+        xa_page_cache_memory_hash(instance, entry->memory)];
+    while (*link != entry){
+        link = &(*link)->memory_next;
+    }
+    *link = entry->memory_next;
+
+    /* remove from the LRU list */
+    if (NULL != entry->prev){
+        entry->prev->next = entry->next;
+    }
+    else{
+        instance->page_cache_head = entry->next;
+    }
+    if (NULL != entry->next){
+        entry->next->prev = entry->prev;
+    }
+    else{
+        instance->page_cache_tail = entry->prev;
+    }
+
+    xa_dbprint("--Page cache evict (0x%.8lx)\n", entry->frame_num);
+    instance->backend->unmap(instance, entry->memory, instance->page_size);
+    instance->stats.page_unmaps++;
+    free(entry);
+    instance->current_page_cache_size--;
+}
+
+/* evicts unused pages, oldest first, until at most size remain */
+static void xa_page_cache_shrink (xa_instance_t *instance, uint32_t size)
+{
+    xa_page_cache_entry_t current = instance->page_cache_head;
+    xa_page_cache_entry_t tmp = NULL;
+
+    while (current != NULL && instance->current_page_cache_size > size){
+        tmp = current->next;
+        if (0 == current->refcount){
+            xa_page_cache_remove(instance, current);
+        }
+        current = tmp;
+    }
+}
+
+void *xa_check_page_cache (xa_instance_t *instance, unsigned long frame_num)
+{
+    xa_page_cache_entry_t current = NULL;
+
+    if (NULL == instance->page_cache_frames){
+        instance->page_cache_misses++;
+        return NULL;
+    }
+
+    current = instance->page_cache_frames[xa_page_cache_frame_hash(frame_num)];
+    while (current != NULL){
+        if (current->frame_num == frame_num){
+            current->refcount++;
+            xa_page_cache_touch(instance, current);
+            instance->page_cache_hits++;
+            return current->memory;
+        }
+        current = current->frame_next;
+    }
+
+    instance->page_cache_misses++;
+    return NULL;
+}
+
+int xa_update_page_cache (
+    xa_instance_t *instance, unsigned long frame_num, void *memory)
+{
+    xa_page_cache_entry_t new_entry = NULL;
+    uint32_t bucket = 0;
+
+    /* is cache enabled? */
+    if (0 == instance->page_cache_size){
+        return 0;
+    }
+
+    /* allocate the hash tables on first use */
+    if (NULL == instance->page_cache_frames){
+        instance->page_cache_frames = calloc(
+            XA_PAGE_CACHE_BUCKETS, sizeof(xa_page_cache_entry_t));
+        instance->page_cache_memory = calloc(
+            XA_PAGE_CACHE_BUCKETS, sizeof(xa_page_cache_entry_t));
+        if (NULL == instance->page_cache_frames ||
+            NULL == instance->page_cache_memory){
+            free(instance->page_cache_frames);
+            free(instance->page_cache_memory);
+            instance->page_cache_frames = NULL;
+            instance->page_cache_memory = NULL;
+            return 0;
+        }
+    }
+
+    /* do we need to remove anything from the cache? */
+    if (instance->current_page_cache_size >= instance->page_cache_size){
+        xa_page_cache_shrink(instance, instance->page_cache_size - 1);
+
+        /* every cached page is in use, so leave this one uncached */
+        if (instance->current_page_cache_size >= instance->page_cache_size){
+            return 0;
+        }
+    }
+
+    new_entry = (xa_page_cache_entry_t)
+        malloc(sizeof(struct xa_page_cache_entry));
+    if (NULL == new_entry){
+        return 0;
+    }
+    new_entry->frame_num = frame_num;
+    new_entry->memory = memory;
+    new_entry->refcount = 1;
+
+    bucket = xa_page_cache_frame_hash(frame_num);
+    new_entry->frame_next = instance->page_cache_frames[bucket];
+    instance->page_cache_frames[bucket] = new_entry;
+
+    bucket = xa_page_cache_memory_hash(instance, memory);
+    new_entry->memory_next = instance->page_cache_memory[bucket];
+    instance->page_cache_memory[bucket] = new_entry;
+
+    /* add it to the end of the list */
+    if (NULL != instance->page_cache_tail){
+        instance->page_cache_tail->next = new_entry;
+    }
+    new_entry->prev = instance->page_cache_tail;
+    instance->page_cache_tail = new_entry;
+    if (NULL == instance->page_cache_head){
+        instance->page_cache_head = new_entry;
+    }
+    new_entry->next = NULL;
+    instance->current_page_cache_size++;
+    xa_dbprint("++Page cache set (0x%.8lx --> %p)\n", frame_num, memory);
+    return 1;
+}
+
+int xa_release_page_cache (xa_instance_t *instance, void *memory)
+{
+    xa_page_cache_entry_t current = NULL;
+
+    if (NULL == instance->page_cache_memory){
+        return 0;
+    }
+
+    current = instance->page_cache_memory[
+        xa_page_cache_memory_hash(instance, memory)];
+    while (current != NULL){
+        if (current->memory == memory){
+            if (current->refcount > 0){
+                current->refcount--;
+            }
+            return 1;
+        }
+        current = current->memory_next;
+    }
+    return 0;
+}
+
+int xa_destroy_page_cache (xa_instance_t *instance)
+{
+    xa_page_cache_entry_t current = instance->page_cache_head;
+    xa_page_cache_entry_t tmp = NULL;
+    while (current != NULL){
+        tmp = current->next;
+        instance->backend->unmap(
+            instance, current->memory, instance->page_size);
+        instance->stats.page_unmaps++;
+        free(current);
+        current = tmp;
+    }
+    free(instance->page_cache_frames);
+    free(instance->page_cache_memory);
+
+    instance->page_cache_frames = NULL;
+    instance->page_cache_memory = NULL;
+    instance->page_cache_head = NULL;
+    instance->page_cache_tail = NULL;
+    instance->current_page_cache_size = 0;
+    return 0;
+}
+
+int xa_set_page_cache_size (xa_instance_t *instance, uint32_t size)
+{
+    instance->page_cache_size = size;
+    xa_page_cache_shrink(instance, size);
+    xa_dbprint("**set instance->page_cache_size = %d\n", size);
+    return XA_SUCCESS;
+}
+
+void xa_get_page_cache_stats (
+    xa_instance_t *instance, uint32_t *hits, uint32_t *misses)
+{
+    if (NULL != hits){
+        *hits = instance->page_cache_hits;
+    }
+    if (NULL != misses){
+        *misses = instance->page_cache_misses;
+    }
+}
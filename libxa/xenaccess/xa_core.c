@@ -50,51 +50,6 @@
 #include <xen/arch-x86/xen.h>
 #endif /* ENABLE_XEN */
 
-int get_memory_size (xa_instance_t *instance)
-{
-    int ret = XA_SUCCESS;
-
-    if (XA_MODE_XEN == instance->mode){
-#ifdef ENABLE_XEN
-        struct xs_handle *xsh = NULL;
-        xs_transaction_t xth = XBT_NULL;
-        char *tmp = malloc(100);
-        if (NULL == tmp){
-            fprintf(stderr, "ERROR: failed to allocate memory for tmp variable\n");
-            ret = XA_FAILURE;
-            goto error_exit;
-        }
-        memset(tmp, 0, 100);
-        sprintf(tmp, "/local/domain/%d/memory/target",
-            instance->m.xen.domain_id);
-        xsh = xs_domain_open();
-        instance->m.xen.size =
-            strtol(xs_read(xsh, xth, tmp, NULL), NULL, 10) * 1024;
-        if (0 == instance->m.xen.size){
-            fprintf(stderr, "ERROR: failed to get memory size for Xen domain.\n");
-            ret = XA_FAILURE;
-            goto error_exit;
-        }
-        xa_dbprint("**set instance->m.xen.size = %d\n", instance->m.xen.size);
-        if (xsh) xs_daemon_close(xsh);
-#endif /* ENABLE_XEN */
-    }
-    else if (XA_MODE_FILE == instance->mode){
-        struct stat s;
-
-        if (fstat(fileno(instance->m.file.fhandle), &s) == -1){
-            fprintf(stderr, "ERROR: Failed to stat file\n");
-            ret = XA_FAILURE;
-            goto error_exit;
-        }
-        instance->m.file.size = (uint32_t) s.st_size;
-        xa_dbprint("**set instance->m.file.size = %d\n", instance->m.file.size);
-    }
-
-error_exit:
-    return ret;
-}
-
 int read_config_file (xa_instance_t *instance)
 {
     extern FILE *yyin;
@@ -147,6 +102,31 @@ int read_config_file (xa_instance_t *instance)
     /* copy the values from entry into instance struct */
     instance->sysmap = strdup(entry->sysmap);
     xa_dbprint("--got sysmap from config (%s).\n", instance->sysmap);
+
+    /* the pagefile is optional, so carry on without it */
+    if ('\0' != entry->pagefile[0]){
+        xa_set_pagefile(instance, entry->pagefile);
+    }
+
+    /* symbols are saved between runs if a file is given for them */
+    if ('\0' != entry->symcache[0]){
+        xa_symcache_open(instance, entry->symcache);
+    }
+
+    /* cache sizes are optional, zero keeps the defaults */
+    if (entry->symbol_cache_size > 0){
+        xa_set_cache_size(instance, entry->symbol_cache_size);
+    }
+    if (entry->pid_cache_size > 0){
+        xa_set_pid_cache_size(instance, entry->pid_cache_size);
+    }
+
+    /* long mode can't be seen in images or the HVM context, so a
+       64-bit guest may be named here */
+    if (64 == entry->address_size){
+        instance->ia32e = 1;
+        xa_dbprint("**set instance->ia32e = 1 (config)\n");
+    }
     
     if (strncmp(entry->ostype, "Linux", CONFIG_STR_LENGTH) == 0){
         instance->os_type = XA_OS_LINUX;
@@ -300,9 +280,25 @@ int get_page_info_xen (xa_instance_t *instance)
     instance->pse = xa_get_bit(ctxt.ctrlreg[4], 4);
     xa_dbprint("**set instance->pse = %d\n", instance->pse);
 
+#ifdef XEN_DOMCTL_get_address_size
+    /* a 64-bit PV guest runs in long mode, which uses IA-32e paging;
+       the HVM equivalent (EFER.LMA) is not in this context */
+    if (instance->pae && !xa_ishvm(instance->m.xen.domain_id)){
+        struct xen_domctl domctl;
+        memset(&domctl, 0, sizeof(domctl));
+        domctl.cmd = XEN_DOMCTL_get_address_size;
+        domctl.domain = instance->m.xen.domain_id;
+        if (xc_domctl(instance->m.xen.xc_handle, &domctl) == 0){
+            instance->ia32e = (64 == domctl.u.address_size.size);
+        }
+    }
+#endif /* XEN_DOMCTL_get_address_size */
+    xa_dbprint("**set instance->ia32e = %d\n", instance->ia32e);
+
     /* testing to see CR3 value */
-    instance->cr3 = ctxt.ctrlreg[3] & 0xFFFFF000;
-    xa_dbprint("**set instance->cr3 = 0x%.8x\n", instance->cr3);
+    instance->cr3 = ctxt.ctrlreg[3] &
+        (instance->ia32e ? 0xFFFFFFFFFF000ULL : 0xFFFFF000);
+    xa_dbprint("**set instance->cr3 = 0x%.8llx\n", instance->cr3);
 #endif /* ENABLE_XEN */
 
 error_exit:
@@ -462,8 +458,10 @@ int helper_init (xa_instance_t *instance)
     else{
         /*TODO add memory layout discovery here for file */
         instance->hvm = 1; /* assume nonvirt image or hvm image for now */
-        instance->pae = 0; /* assume no pae for now */
+        instance->pae = instance->ia32e; /* long mode implies pae */
+        instance->pse = 1; /* large pages may be used */
     }
+    xa_set_paging_mode(instance);
     xa_dbprint("--got memory layout.\n");
 
     /* setup the correct page offset size for the target OS */
@@ -484,9 +482,10 @@ int helper_init (xa_instance_t *instance)
 #endif /* ENABLE_XEN */
     }
 
-    /* get the memory size */
-    if (get_memory_size(instance) == XA_FAILURE){
-        fprintf(stderr, "ERROR: Failed to get memory size.\n");
+    /* get the memory size and prepare the backend for access */
+    xa_dbprint("--using %s memory backend.\n", instance->backend->name);
+    if (instance->backend->init(instance) == XA_FAILURE){
+        fprintf(stderr, "ERROR: Failed to initialize memory access.\n");
         ret = xa_report_error(instance, 0, XA_ECRITICAL);
         if (XA_FAILURE == ret) goto error_exit;
     }
@@ -507,17 +506,17 @@ error_exit:
  * than the xc_handle and the domain_id */
 int helper_destroy (xa_instance_t *instance)
 {
-#ifdef ENABLE_XEN
-    if (instance->m.xen.live_pfn_to_mfn_table){
-        munmap(instance->m.xen.live_pfn_to_mfn_table,
-               instance->m.xen.nr_pfns * 4);
-    }
-#endif /* ENABLE_XEN */
-
+    xa_destroy_symcache(instance);
+    linux_destroy_system_map(instance);
     xa_destroy_cache(instance);
+    xa_destroy_tlb(instance);
     xa_destroy_pid_cache(instance);
+    xa_destroy_pt_watch(instance);
+    xa_destroy_page_cache(instance);
+    xa_destroy_reverse_map(instance);
+    xa_destroy_pagefile(instance);
 
-    return XA_SUCCESS;
+    return instance->backend->destroy(instance);
 }
 
 /* common code for all init functions */
@@ -526,10 +525,50 @@ void xa_init_common (xa_instance_t *instance)
     xa_dbprint("XenAccess Devel Version\n");
     instance->cache_head = NULL;
     instance->cache_tail = NULL;
+    instance->cache_symbols = NULL;
+    instance->cache_virt = NULL;
+    instance->cache_bucket_count = 0;
+    instance->cache_size = XA_CACHE_SIZE;
     instance->current_cache_size = 0;
+    instance->direct_map_end = 0;
+    instance->ia32e = 0;
+    instance->tlb = NULL;
+    instance->tlb_size = XA_TLB_SIZE;
+    instance->tlb_sets = 0;
+    instance->tlb_clock = 0;
+    instance->pt_watch = NULL;
+    instance->pt_watch_clock = 0;
+    instance->invalidate_epoch = 0;
+    instance->invalidate_count = 0;
+    instance->tlb_hits = 0;
+    instance->tlb_misses = 0;
+    instance->pde_cache = NULL;
+    instance->neg_cache = NULL;
+    instance->neg_clock = 0;
     instance->pid_cache_head = NULL;
     instance->pid_cache_tail = NULL;
+    instance->pid_cache_buckets = NULL;
+    instance->pid_cache_bucket_count = 0;
+    instance->pid_cache_size = XA_PID_CACHE_SIZE;
     instance->current_pid_cache_size = 0;
+    instance->page_cache_head = NULL;
+    instance->page_cache_tail = NULL;
+    instance->page_cache_frames = NULL;
+    instance->page_cache_memory = NULL;
+    instance->page_cache_size = XA_PAGE_CACHE_SIZE;
+    instance->current_page_cache_size = 0;
+    instance->page_cache_hits = 0;
+    instance->page_cache_misses = 0;
+    memset(&instance->stats, 0, sizeof(xa_stats_t));
+    instance->rmap = NULL;
+    instance->rmap_count = 0;
+    instance->rmap_space = 0;
+    instance->pagefile = NULL;
+    instance->pagefile_size = 0;
+    instance->pagefile_cache = NULL;
+    instance->pagefile_clock = 0;
+    instance->symcache = NULL;
+    instance->sysmap_index = NULL;
 }
 
 /* initialize to view an actively running Xen domain */
@@ -550,6 +589,7 @@ int xa_init_vm_private
         return XA_FAILURE;
     }
     instance->m.xen.xc_handle = xc_handle;
+    instance->backend = &xa_xen_backend;
 
     xa_init_common(instance);
     instance->m.xen.domain_id = domain_id;
@@ -570,6 +610,7 @@ int xa_init_file_private (
 {
 #define MAX_IMAGE_TYPE_LEN 256
     FILE *fhandle = NULL;
+    bzero(instance, sizeof(xa_instance_t));
     instance->mode = XA_MODE_FILE;
     xa_dbprint("XenAccess Mode File\n");
     instance->error_mode = error_mode;
@@ -581,6 +622,35 @@ int xa_init_file_private (
         return XA_FAILURE;
     }
     instance->m.file.fhandle = fhandle;
+    if (xa_snapshot_probe(fhandle)){
+        instance->backend = &xa_snapshot_backend;
+    }
+    else{
+        instance->backend = &xa_file_backend;
+    }
+
+    xa_init_common(instance);
+    instance->image_type = strndup(image_type, MAX_IMAGE_TYPE_LEN);
+    return helper_init(instance);
+}
+
+/* initialize to view memory held in a local buffer */
+int xa_init_mock_private (
+    unsigned char *memory,
+    uint64_t size,
+    char *image_type,
+    xa_instance_t *instance,
+    uint32_t error_mode)
+{
+    bzero(instance, sizeof(xa_instance_t));
+    instance->mode = XA_MODE_MOCK;
+    xa_dbprint("XenAccess Mode Mock\n");
+    instance->error_mode = error_mode;
+    xa_dbprint("XenAccess Error Mode = %d\n", instance->error_mode);
+
+    instance->m.mock.memory = memory;
+    instance->m.mock.size = size;
+    instance->backend = &xa_mock_backend;
 
     xa_init_common(instance);
     instance->image_type = strndup(image_type, MAX_IMAGE_TYPE_LEN);
@@ -621,23 +691,36 @@ int xa_init_file_lax
 {
     return xa_init_file_private(filename, image_type, instance, XA_FAILSOFT);
 }
+int xa_init_mock_strict (unsigned char *memory, uint64_t size,
+    char *image_type, xa_instance_t *instance)
+{
+    return xa_init_mock_private(
+        memory, size, image_type, instance, XA_FAILHARD);
+}
+int xa_init_mock_lax (unsigned char *memory, uint64_t size,
+    char *image_type, xa_instance_t *instance)
+{
+    return xa_init_mock_private(
+        memory, size, image_type, instance, XA_FAILSOFT);
+}
 
 int xa_destroy (xa_instance_t *instance)
 {
-    int ret1, ret2;
-
-#ifdef ENABLE_XEN
-    instance->m.xen.domain_id = 0;
-#endif /* ENABLE_XEN */
-
-    ret1 = helper_destroy(instance);
+    return helper_destroy(instance);
+}
 
-#ifdef ENABLE_XEN
-    ret2 = xc_interface_close(instance->m.xen.xc_handle);
-#endif /* ENABLE_XEN */
+int xa_pause_vm (xa_instance_t *instance)
+{
+    if (NULL == instance->backend->pause){
+        return XA_SUCCESS;
+    }
+    return instance->backend->pause(instance);
+}
 
-    if (XA_FAILURE == ret1 || XA_FAILURE == ret2){
-        return XA_FAILURE;
+int xa_resume_vm (xa_instance_t *instance)
+{
+    if (NULL == instance->backend->resume){
+        return XA_SUCCESS;
     }
-    return XA_SUCCESS;
+    return instance->backend->resume(instance);
 }
@@ -27,24 +27,361 @@
  * Author(s): Bryan D. Payne (bryan@thepaynes.cc)
  */
 
+/* config.h selects 64-bit file offsets, so it must come first */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#define _GNU_SOURCE
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "xenaccess.h"
+#include "xa_private.h"
+
+/* returns the number of bytes of the image covered by the given window */
+static size_t xa_file_window_length (xa_instance_t *instance, uint32_t window)
+{
+    uint64_t start = (uint64_t) window << instance->m.file.window_shift;
+    uint64_t length = instance->m.file.size - start;
+
+    if (length > (1ULL << instance->m.file.window_shift)){
+        length = 1ULL << instance->m.file.window_shift;
+    }
+    return (size_t) length;
+}
+
+/* returns a pointer to the start of the given window, mapping it first
+   if this is the first time that it has been used */
+static unsigned char *xa_file_get_window (
+        xa_instance_t *instance, uint32_t window)
+{
+    unsigned char *memory = NULL;
+    off_t start = 0;
+    size_t length = 0;
+    int fildes = fileno(instance->m.file.fhandle);
+
+    if (window >= instance->m.file.nr_windows){
+        return NULL;
+    }
+    if (NULL != instance->m.file.windows[window]){
+        return instance->m.file.windows[window];
+    }
+
+    /* only keep a bounded amount of the image mapped on small hosts */
+    if (instance->m.file.nr_mapped >= XA_FILE_MAX_WINDOWS){
+        return NULL;
+    }
+
+    start = (off_t) window << instance->m.file.window_shift;
+    length = xa_file_window_length(instance, window);
+    memory = mmap(NULL, length, PROT_READ, MAP_SHARED, fildes, start);
+    if (MAP_FAILED == memory){
+        perror("xa_file.c: window mmap failed");
+        return NULL;
+    }
+    xa_dbprint("--FileMap: mapped window %d (0x%.8lx bytes)\n",
+        window, (unsigned long) length);
+    instance->m.file.windows[window] = memory;
+    instance->m.file.nr_mapped++;
+    return memory;
+}
+
+static int xa_file_init (xa_instance_t *instance)
+{
+    uint32_t shift = XA_FILE_WINDOW_SHIFT;
+    struct stat s;
+
+    if (fstat(fileno(instance->m.file.fhandle), &s) == -1){
+        fprintf(stderr, "ERROR: Failed to stat file\n");
+        return XA_FAILURE;
+    }
+    instance->m.file.size = s.st_size;
+    xa_dbprint("**set instance->m.file.size = %llu\n", instance->m.file.size);
+
+    /* on 64-bit hosts there is plenty of address space, so the
+       whole image is covered by a single mapping */
+    if (sizeof(void *) >= 8){
+        shift = instance->page_shift;
+        while (shift < 62 && (1ULL << shift) < instance->m.file.size){
+            ++shift;
+        }
+    }
+    instance->m.file.window_shift = shift;
+    instance->m.file.nr_windows = (uint32_t)
+        ((instance->m.file.size + (1ULL << shift) - 1) >> shift);
+    instance->m.file.nr_mapped = 0;
+    xa_dbprint("**set instance->m.file.nr_windows = %d\n",
+        instance->m.file.nr_windows);
 
-void *xa_map_file_range (xa_instance_t *instance, int prot, unsigned long pfn)
+    instance->m.file.windows =
+        malloc(instance->m.file.nr_windows * sizeof(unsigned char *));
+    if (NULL == instance->m.file.windows){
+        fprintf(stderr, "ERROR: failed to allocate file window table\n");
+        return XA_FAILURE;
+    }
+    memset(instance->m.file.windows, 0,
+        instance->m.file.nr_windows * sizeof(unsigned char *));
+
+    /* map the whole image up front when it fits in one window */
+    if (1 == instance->m.file.nr_windows){
+        if (NULL == xa_file_get_window(instance, 0)){
+            return XA_FAILURE;
+        }
+    }
+    return XA_SUCCESS;
+}
+
+static int xa_file_destroy (xa_instance_t *instance)
+{
+    uint32_t i = 0;
+
+    if (NULL != instance->m.file.windows){
+        for (i = 0; i < instance->m.file.nr_windows; ++i){
+            if (NULL == instance->m.file.windows[i]){
+                continue;
+            }
+            munmap(instance->m.file.windows[i],
+                xa_file_window_length(instance, i));
+        }
+        free(instance->m.file.windows);
+    }
+    instance->m.file.windows = NULL;
+    instance->m.file.nr_windows = 0;
+    instance->m.file.nr_mapped = 0;
+
+    if (NULL != instance->m.file.fhandle){
+        fclose(instance->m.file.fhandle);
+        instance->m.file.fhandle = NULL;
+    }
+    return XA_SUCCESS;
+}
+
+static uint64_t xa_file_get_size (xa_instance_t *instance)
+{
+    return instance->m.file.size;
+}
+
+/* file offset == physical address for dd images */
+static unsigned long xa_file_pfn_to_mfn (
+        xa_instance_t *instance, unsigned long pfn)
+{
+    return pfn;
+}
+
+static int xa_file_owns (xa_instance_t *instance, void *memory)
+{
+    unsigned char *ptr = (unsigned char *) memory;
+    uint32_t i = 0;
+
+    if (NULL == instance->m.file.windows){
+        return 0;
+    }
+    for (i = 0; i < instance->m.file.nr_windows; ++i){
+        unsigned char *base = instance->m.file.windows[i];
+        if (NULL != base && ptr >= base &&
+            ptr < base + xa_file_window_length(instance, i)){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *xa_file_window_page (
+        xa_instance_t *instance, unsigned long pfn)
+{
+    unsigned char *window = NULL;
+    uint64_t address = (uint64_t) pfn << instance->page_shift;
+
+    if (NULL == instance->m.file.windows || address >= instance->m.file.size){
+        return NULL;
+    }
+
+    window = xa_file_get_window(
+        instance, address >> instance->m.file.window_shift);
+    if (NULL == window){
+        return NULL;
+    }
+    return window + (address & ((1ULL << instance->m.file.window_shift) - 1));
+}
+
+static void *xa_file_map_page (
+        xa_instance_t *instance, int prot, unsigned long pfn)
 {
     void *memory = NULL;
-    long address = pfn << instance->page_shift;
+    uint64_t address = (uint64_t) pfn << instance->page_shift;
     int fildes = fileno(instance->m.file.fhandle);
 
     if (address >= instance->m.file.size){
         return NULL;
     }
 
-    memory = mmap(NULL, instance->page_size, prot, MAP_SHARED, fildes, address);
+    /* read-only requests are served from the persistent mapping */
+    if (!(prot & PROT_WRITE)){
+        memory = xa_file_window_page(instance, pfn);
+        if (NULL != memory){
+            return memory;
+        }
+    }
+
+    /* otherwise fall back on a separate mapping for this page */
+    memory = mmap(NULL, instance->page_size, prot, MAP_SHARED, fildes,
+        (off_t) address);
     if (MAP_FAILED == memory){
         perror("xa_file.c: file mmap failed");
         return NULL;
     }
     return memory;
 }
+
+static void *xa_file_map_pages (
+        xa_instance_t *instance, int prot,
+        const unsigned long *pfns, uint32_t num)
+{
+    unsigned char *memory = NULL;
+    void *page = NULL;
+    uint64_t address = 0;
+    uint32_t i = 0;
+    int fildes = fileno(instance->m.file.fhandle);
+
+    /* reserve a contiguous range of addresses for the whole view */
+    memory = mmap(NULL, num * instance->page_size, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == memory){
+        perror("xa_file.c: range reservation failed");
+        return NULL;
+    }
+
+    /* then put each page of the image into its place in the range */
+    for (i = 0; i < num; ++i){
+        address = (uint64_t) pfns[i] << instance->page_shift;
+        if (address >= instance->m.file.size){
+            fprintf(stderr, "ERROR: pfn 0x%lx is beyond the memory image\n",
+                pfns[i]);
+            goto error_exit;
+        }
+        page = mmap(memory + i * instance->page_size, instance->page_size,
+            prot, MAP_SHARED | MAP_FIXED, fildes, (off_t) address);
+        if (MAP_FAILED == page){
+            perror("xa_file.c: file mmap failed");
+            goto error_exit;
+        }
+    }
+    return memory;
+
+error_exit:
+    munmap(memory, num * instance->page_size);
+    return NULL;
+}
+
+static int xa_file_unmap (xa_instance_t *instance, void *memory, uint32_t length)
+{
+    /* memory from the persistent image mapping stays mapped */
+    if (xa_file_owns(instance, memory)){
+        return XA_SUCCESS;
+    }
+    if (munmap(memory, length) != 0){
+        return XA_FAILURE;
+    }
+    return XA_SUCCESS;
+}
+
+static int xa_file_read (
+        xa_instance_t *instance, uint64_t paddr, void *buf, uint32_t count)
+{
+    unsigned char *window = NULL;
+    uint64_t window_size = 1ULL << instance->m.file.window_shift;
+    uint32_t chunk = 0;
+    ssize_t ret = 0;
+
+    if (paddr >= instance->m.file.size ||
+        count > instance->m.file.size - paddr){
+        return XA_FAILURE;
+    }
+
+    while (count){
+        /* the window may be larger than a 32-bit count can hold */
+        uint64_t left = window_size - (paddr & (window_size - 1));
+        chunk = (left > count) ? count : (uint32_t) left;
+
+        /* copy from the persistent mapping when we can */
+        window = NULL;
+        if (NULL != instance->m.file.windows){
+            window = xa_file_get_window(
+                instance, paddr >> instance->m.file.window_shift);
+        }
+        if (NULL != window){
+            memcpy(buf, window + (paddr & (window_size - 1)), chunk);
+        }
+        else{
+            ret = pread(fileno(instance->m.file.fhandle), buf, chunk,
+                (off_t) paddr);
+            if (ret != chunk){
+                return XA_FAILURE;
+            }
+        }
+        paddr += chunk;
+        buf = (unsigned char *) buf + chunk;
+        count -= chunk;
+    }
+    return XA_SUCCESS;
+}
+
+/* sparse images are scanned one data region at a time, so the extent of
+   the last region found is kept to avoid asking for it on every page */
+static uint64_t xa_file_next_data (xa_instance_t *instance, uint64_t paddr)
+{
+#ifdef SEEK_DATA
+    int fildes = fileno(instance->m.file.fhandle);
+    off_t start = 0;
+    off_t end = 0;
+
+    if (paddr >= instance->m.file.size ||
+        (paddr >= instance->m.file.data_start &&
+         paddr < instance->m.file.data_end)){
+        return paddr;
+    }
+
+    start = lseek(fildes, (off_t) paddr, SEEK_DATA);
+    if (-1 == start){
+        /* ENXIO means there is only a hole after paddr, anything else
+           means that the file system can't tell us */
+        return (ENXIO == errno) ? instance->m.file.size : paddr;
+    }
+    end = lseek(fildes, start, SEEK_HOLE);
+    if (-1 == end){
+        end = instance->m.file.size;
+    }
+    instance->m.file.data_start = start;
+    instance->m.file.data_end = end;
+    if (start > paddr){
+        xa_dbprint("--FileMap: skipped hole 0x%llx - 0x%llx\n",
+            paddr, (unsigned long long) start);
+    }
+    return start;
+#else
+    return paddr;
+#endif /* SEEK_DATA */
+}
+
+struct xa_backend xa_file_backend = {
+    .name = "file",
+    .init = xa_file_init,
+    .destroy = xa_file_destroy,
+    .get_size = xa_file_get_size,
+    .pfn_to_mfn = xa_file_pfn_to_mfn,
+    .map_page = xa_file_map_page,
+    .map_pages = xa_file_map_pages,
+    .direct_page = xa_file_window_page,
+    .unmap = xa_file_unmap,
+    .read = xa_file_read,
+    .next_data = xa_file_next_data,
+    .pause = NULL,
+    .resume = NULL,
+    .get_vcpureg = NULL
+};
@@ -29,6 +29,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include "xenaccess.h"
 #include "xa_private.h"
@@ -122,9 +123,9 @@ unsigned long helper_pfn_to_mfn (xa_instance_t *instance, unsigned long pfn)
     ret = instance->m.xen.live_pfn_to_mfn_table[pfn];
 
 error_exit:
-    if (live_shinfo) munmap(live_shinfo, XC_PAGE_SIZE);
+    if (live_shinfo) xa_munmap(instance, live_shinfo, XC_PAGE_SIZE);
     if (live_pfn_to_mfn_frame_list_list)
-        munmap(live_pfn_to_mfn_frame_list_list, XC_PAGE_SIZE);
+        xa_munmap(instance, live_pfn_to_mfn_frame_list_list, XC_PAGE_SIZE);
     if (live_pfn_to_mfn_frame_list)
         munmap(live_pfn_to_mfn_frame_list, XC_PAGE_SIZE);
 
@@ -142,14 +143,7 @@ void *xa_mmap_mfn (xa_instance_t *instance, int prot, unsigned long mfn)
 
 void *xa_mmap_pfn (xa_instance_t *instance, int prot, unsigned long pfn)
 {
-    unsigned long mfn = -1;
-
-    if (XA_MODE_XEN == instance->mode){
-        mfn = helper_pfn_to_mfn(instance, pfn);
-    }
-    else if (XA_MODE_FILE == instance->mode){
-        mfn = pfn;
-    }
+    unsigned long mfn = instance->backend->pfn_to_mfn(instance, pfn);
 
     if (-1 == mfn){
         fprintf(stderr, "ERROR: pfn to mfn mapping failed.\n");
@@ -163,11 +157,11 @@ void *xa_mmap_pfn (xa_instance_t *instance, int prot, unsigned long pfn)
 
 /* bit flag testing */
 int entry_present (unsigned long entry){
-    return xa_get_bit(entry, 0);
+    return entry & 1;
 }
 
 int page_size_flag (unsigned long entry){
-    return xa_get_bit(entry, 7);
+    return (entry >> 7) & 1;
 }
 
 /* page directory pointer table */
@@ -179,22 +173,71 @@ uint32_t pdpi_index (uint32_t pdpi){
     return (pdpi >> 30) * sizeof(uint64_t);
 }
 
+/* reads a 64-bit paging entry, through the PDE cache */
+static uint64_t get_entry_cached (xa_instance_t *instance, uint64_t entry)
+{
+    uint64_t value = 0;
+    if (!xa_check_pde_cache(instance, entry, &value)){
+        if (xa_read_long_long_mach(instance, entry, &value) ==
+                XA_SUCCESS && entry_present(value)){
+            xa_update_pde_cache(instance, entry, value);
+        }
+    }
+    return value;
+}
+
 uint64_t get_pdpi (xa_instance_t *instance, uint32_t vaddr, uint32_t cr3)
 {
-    uint64_t value;
     uint32_t pdpi_entry = get_pdptb(cr3) + pdpi_index(vaddr);
     xa_dbprint("--PTLookup: pdpi_entry = 0x%.8x\n", pdpi_entry);
-    xa_read_long_long_mach(instance, pdpi_entry, &value);
-    return value;
+    return get_entry_cached(instance, pdpi_entry);
+}
+
+/* page map level 4 (IA-32e) */
+uint64_t get_pml4tb (uint64_t cr3){
+    return cr3 & 0xFFFFFFFFFF000ULL;
+}
+
+uint32_t pml4_index (xa_addr_t vaddr){
+    return ((vaddr >> 39) & 0x1FF) * sizeof(uint64_t);
+}
+
+uint64_t get_pml4e (xa_instance_t *instance, xa_addr_t vaddr, uint64_t cr3)
+{
+    uint64_t pml4_entry = get_pml4tb(cr3) + pml4_index(vaddr);
+    xa_dbprint("--PTLookup: pml4_entry = 0x%.8llx\n", pml4_entry);
+    return get_entry_cached(instance, pml4_entry);
+}
+
+/* page directory pointer table (IA-32e) */
+uint32_t pdpi_index_ia32e (xa_addr_t vaddr){
+    return ((vaddr >> 30) & 0x1FF) * sizeof(uint64_t);
+}
+
+uint64_t get_pdpe_ia32e (
+        xa_instance_t *instance, xa_addr_t vaddr, uint64_t pml4e)
+{
+    uint64_t pdpi_entry =
+        (pml4e & 0xFFFFFFFFFF000ULL) + pdpi_index_ia32e(vaddr);
+    xa_dbprint("--PTLookup: pdpi_entry = 0x%.8llx\n", pdpi_entry);
+    return get_entry_cached(instance, pdpi_entry);
 }
 
 /* page directory */
-uint32_t pgd_index (xa_instance_t *instance, uint32_t address){
+uint32_t pgd_index_nopae (uint32_t address){
+    return ((address >> 22) & 0x3FF) * sizeof(uint32_t);
+}
+
+uint32_t pgd_index_pae (xa_addr_t address){
+    return ((address >> 21) & 0x1FF) * sizeof(uint64_t);
+}
+
+uint32_t pgd_index (xa_instance_t *instance, xa_addr_t address){
     if (!instance->pae){
-        return (((address) >> 22) & 0x3FF) * sizeof(uint32_t);
+        return pgd_index_nopae(address);
     }
     else{
-        return (((address) >> 21) & 0x1FF) * sizeof(uint64_t);
+        return pgd_index_pae(address);
     }
 }
 
@@ -203,34 +246,47 @@ uint32_t pdba_base_nopae (uint32_t pdpe){
 }
 
 uint64_t pdba_base_pae (uint64_t pdpe){
-    return pdpe & 0xFFFFFF000ULL;
+    return pdpe & 0xFFFFFFFFFF000ULL;
 }
 
 uint32_t get_pgd_nopae (xa_instance_t *instance, uint32_t vaddr, uint32_t pdpe)
 {
-    uint32_t value;
-    uint32_t pgd_entry = pdba_base_nopae(pdpe) + pgd_index(instance, vaddr);
+    uint32_t value = 0;
+    uint64_t cached = 0;
+    uint32_t pgd_entry = pdba_base_nopae(pdpe) + pgd_index_nopae(vaddr);
     xa_dbprint("--PTLookup: pgd_entry = 0x%.8x\n", pgd_entry);
-    xa_read_long_mach(instance, pgd_entry, &value);
+    if (xa_check_pde_cache(instance, pgd_entry, &cached)){
+        return (uint32_t) cached;
+    }
+    if (xa_read_long_mach(instance, pgd_entry, &value) == XA_SUCCESS &&
+        entry_present(value)){
+        xa_update_pde_cache(instance, pgd_entry, value);
+    }
     return value;
 }
 
-uint64_t get_pgd_pae (xa_instance_t *instance, uint32_t vaddr, uint64_t pdpe)
+uint64_t get_pgd_pae (xa_instance_t *instance, xa_addr_t vaddr, uint64_t pdpe)
 {
-    uint64_t value;
-    uint32_t pgd_entry = pdba_base_pae(pdpe) + pgd_index(instance, vaddr);
-    xa_dbprint("--PTLookup: pgd_entry = 0x%.8x\n", pgd_entry);
-    xa_read_long_long_mach(instance, pgd_entry, &value);
-    return value;
+    uint64_t pgd_entry = pdba_base_pae(pdpe) + pgd_index_pae(vaddr);
+    xa_dbprint("--PTLookup: pgd_entry = 0x%.8llx\n", pgd_entry);
+    return get_entry_cached(instance, pgd_entry);
 }
 
 /* page table */
-uint32_t pte_index (xa_instance_t *instance, uint32_t address){
+uint32_t pte_index_nopae (uint32_t address){
+    return ((address >> 12) & 0x3FF) * sizeof(uint32_t);
+}
+
+uint32_t pte_index_pae (xa_addr_t address){
+    return ((address >> 12) & 0x1FF) * sizeof(uint64_t);
+}
+
+uint32_t pte_index (xa_instance_t *instance, xa_addr_t address){
     if (!instance->pae){
-        return (((address) >> 12) & 0x3FF) * sizeof(uint32_t);
+        return pte_index_nopae(address);
     }
     else{
-        return (((address) >> 12) & 0x1FF) * sizeof(uint64_t); 
+        return pte_index_pae(address);
     }
 }
         
@@ -239,21 +295,21 @@ uint32_t ptba_base_nopae (uint32_t pde){
 }
 
 uint64_t ptba_base_pae (uint64_t pde){
-    return pde & 0xFFFFFF000ULL;
+    return pde & 0xFFFFFFFFFF000ULL;
 }
 
 uint32_t get_pte_nopae (xa_instance_t *instance, uint32_t vaddr, uint32_t pgd){
     uint32_t value;
-    uint32_t pte_entry = ptba_base_nopae(pgd) + pte_index(instance, vaddr);
+    uint32_t pte_entry = ptba_base_nopae(pgd) + pte_index_nopae(vaddr);
     xa_dbprint("--PTLookup: pte_entry = 0x%.8x\n", pte_entry);
     xa_read_long_mach(instance, pte_entry, &value);
     return value;
 }
 
-uint64_t get_pte_pae (xa_instance_t *instance, uint32_t vaddr, uint64_t pgd){
+uint64_t get_pte_pae (xa_instance_t *instance, xa_addr_t vaddr, uint64_t pgd){
     uint64_t value;
-    uint32_t pte_entry = ptba_base_pae(pgd) + pte_index(instance, vaddr);
-    xa_dbprint("--PTLookup: pte_entry = 0x%.8x\n", pte_entry);
+    uint64_t pte_entry = ptba_base_pae(pgd) + pte_index_pae(vaddr);
+    xa_dbprint("--PTLookup: pte_entry = 0x%.8llx\n", pte_entry);
     xa_read_long_long_mach(instance, pte_entry, &value);
     return value;
 }
@@ -264,25 +320,37 @@ uint32_t pte_pfn_nopae (uint32_t pte){
 }
 
 uint64_t pte_pfn_pae (uint64_t pte){
-    return pte & 0xFFFFFF000ULL;
+    return pte & 0xFFFFFFFFFF000ULL;
 }
 
 uint32_t get_paddr_nopae (uint32_t vaddr, uint32_t pte){
     return pte_pfn_nopae(pte) | (vaddr & 0xFFF);
 }
 
-uint64_t get_paddr_pae (uint32_t vaddr, uint64_t pte){
+uint64_t get_paddr_pae (xa_addr_t vaddr, uint64_t pte){
     return pte_pfn_pae(pte) | (vaddr & 0xFFF);
 }
 
-uint32_t get_large_paddr (
-        xa_instance_t *instance, uint32_t vaddr, uint32_t pgd_entry)
+uint32_t get_large_paddr_nopae (uint32_t vaddr, uint32_t pgd_entry){
+    return (pgd_entry & 0xFFC00000) | (vaddr & 0x3FFFFF);
+}
+
+uint64_t get_large_paddr_pae (xa_addr_t vaddr, uint64_t pgd_entry){
+    return (pgd_entry & 0xFFFFFFFE00000ULL) | (vaddr & 0x1FFFFF);
+}
+
+uint64_t get_huge_paddr_ia32e (xa_addr_t vaddr, uint64_t pdpe){
+    return (pdpe & 0xFFFFFC0000000ULL) | (vaddr & 0x3FFFFFFF);
+}
+
+uint64_t get_large_paddr (
+        xa_instance_t *instance, xa_addr_t vaddr, uint64_t pgd_entry)
 {
     if (!instance->pae){
-        return (pgd_entry & 0xFFC00000) | (vaddr & 0x3FFFFF);
+        return get_large_paddr_nopae(vaddr, pgd_entry);
     }
     else{
-        return (pgd_entry & 0xFFE00000) | (vaddr & 0x1FFFFF);
+        return get_large_paddr_pae(vaddr, pgd_entry);
     }
 }
 
@@ -290,21 +358,53 @@ uint32_t get_large_paddr (
  * see "Using Every Part of the Buffalo in Windows Memory Analysis" by
  * Jesse D. Kornblum for details. 
  * for now, just test the bits and print out details */
-int get_transition_bit(uint32_t entry)
+int get_transition_bit(uint64_t entry)
 {
     return xa_get_bit(entry, 11);
 }
 
-int get_prototype_bit(uint32_t entry)
+int get_prototype_bit(uint64_t entry)
 {
     return xa_get_bit(entry, 10);
 }
 
+/* a Windows entry for a page that was trimmed from a working set but
+   is still resident, so its frame number is still good */
+int entry_transition (xa_instance_t *instance, uint64_t entry)
+{
+    return XA_OS_WINDOWS == instance->os_type && !entry_present(entry) &&
+        get_transition_bit(entry) && !get_prototype_bit(entry);
+}
+
+/* gets the pagefile page of a Windows entry for a paged out page, and
+   returns the pagefile number, or -1 if the entry is not in a pagefile */
+int entry_pagefile (xa_instance_t *instance, uint64_t entry, uint64_t *page)
+{
+    if (XA_OS_WINDOWS != instance->os_type || entry_present(entry) ||
+        get_transition_bit(entry) || get_prototype_bit(entry)){
+        return -1;
+    }
+
+    /* PAE and IA-32e entries keep the page in the high 32 bits */
+    if (instance->pae){
+        *page = entry >> 32;
+    }
+    else{
+        *page = (entry >> 12) & 0xFFFFF;
+    }
+
+    /* a zero page number means a demand zero page */
+    if (0 == *page){
+        return -1;
+    }
+    return (entry >> 1) & 0xF;
+}
+
 void buffalo_nopae (xa_instance_t *instance, uint32_t entry, int pde)
 {
     /* similar techniques are surely doable in linux, but for now
      * this is only testing for windows domains */
-    if (!instance->os_type == XA_OS_WINDOWS){
+    if (instance->os_type != XA_OS_WINDOWS){
         return;
     }
 
@@ -344,8 +444,10 @@ void buffalo_nopae (xa_instance_t *instance, uint32_t entry, int pde)
     }
 }
 
-/* translation */
-uint32_t v2p_nopae(xa_instance_t *instance, uint32_t cr3, uint32_t vaddr)
+/* translation, specialised for each paging mode by xa_set_paging_mode
+   so that the hot path has constant masks and no mode checks */
+static inline uint64_t v2p_nopae (
+        xa_instance_t *instance, uint32_t cr3, uint32_t vaddr, int pse)
 {
     uint32_t paddr = 0;
     uint32_t pgd, pte;
@@ -356,14 +458,14 @@ uint32_t v2p_nopae(xa_instance_t *instance, uint32_t cr3, uint32_t vaddr)
     xa_dbprint("--PTLookup: pgd = 0x%.8x\n", pgd);
         
     if (entry_present(pgd)){
-        if (page_size_flag(pgd)){
-            paddr = get_large_paddr(instance, vaddr, pgd);
+        if (pse && page_size_flag(pgd)){
+            paddr = get_large_paddr_nopae(vaddr, pgd);
             xa_dbprint("--PTLookup: 4MB page\n", pgd);
         }
         else{
             pte = get_pte_nopae(instance, vaddr, pgd);
             xa_dbprint("--PTLookup: pte = 0x%.8x\n", pte);
-            if (entry_present(pte)){
+            if (entry_present(pte) || entry_transition(instance, pte)){
                 paddr = get_paddr_nopae(vaddr, pte);
             }
             else{
@@ -378,100 +480,523 @@ uint32_t v2p_nopae(xa_instance_t *instance, uint32_t cr3, uint32_t vaddr)
     return paddr;
 }
 
-uint32_t v2p_pae (xa_instance_t *instance, uint32_t cr3, uint32_t vaddr)
+/* without PSE the page size bit is ignored */
+static uint64_t v2p_nopae_4k (
+        xa_instance_t *instance, uint64_t cr3, xa_addr_t vaddr)
 {
-    uint32_t paddr = 0;
+    return v2p_nopae(instance, cr3, vaddr, 0);
+}
+
+static uint64_t v2p_nopae_pse (
+        xa_instance_t *instance, uint64_t cr3, xa_addr_t vaddr)
+{
+    return v2p_nopae(instance, cr3, vaddr, 1);
+}
+
+static uint64_t v2p_pae (xa_instance_t *instance, uint64_t cr3, xa_addr_t vaddr)
+{
+    uint64_t paddr = 0;
     uint64_t pdpe, pgd, pte;
         
-    xa_dbprint("--PTLookup: lookup vaddr = 0x%.8x\n", vaddr);
-    xa_dbprint("--PTLookup: cr3 = 0x%.8x\n", cr3);
+    xa_dbprint("--PTLookup: lookup vaddr = 0x%.8llx\n", vaddr);
+    xa_dbprint("--PTLookup: cr3 = 0x%.8llx\n", cr3);
     pdpe = get_pdpi(instance, vaddr, cr3);
-    xa_dbprint("--PTLookup: pdpe = 0x%.16x\n", pdpe);
+    xa_dbprint("--PTLookup: pdpe = 0x%.16llx\n", pdpe);
     if (!entry_present(pdpe)){
         return paddr;
     }
     pgd = get_pgd_pae(instance, vaddr, pdpe);
-    xa_dbprint("--PTLookup: pgd = 0x%.16x\n", pgd);
+    xa_dbprint("--PTLookup: pgd = 0x%.16llx\n", pgd);
 
     if (entry_present(pgd)){
         if (page_size_flag(pgd)){
-            paddr = get_large_paddr(instance, vaddr, pgd);
+            paddr = get_large_paddr_pae(vaddr, pgd);
             xa_dbprint("--PTLookup: 2MB page\n");
         }
         else{
             pte = get_pte_pae(instance, vaddr, pgd);
-            xa_dbprint("--PTLookup: pte = 0x%.16x\n", pte);
-            if (entry_present(pte)){
+            xa_dbprint("--PTLookup: pte = 0x%.16llx\n", pte);
+            if (entry_present(pte) || entry_transition(instance, pte)){
                 paddr = get_paddr_pae(vaddr, pte);
             }
         }
     }
-    xa_dbprint("--PTLookup: paddr = 0x%.8x\n", paddr);
+    xa_dbprint("--PTLookup: paddr = 0x%.8llx\n", paddr);
     return paddr;
 }
 
+static uint64_t v2p_ia32e (
+        xa_instance_t *instance, uint64_t cr3, xa_addr_t vaddr)
+{
+    uint64_t paddr = 0;
+    uint64_t pml4e, pdpe, pgd, pte;
+
+    xa_dbprint("--PTLookup: lookup vaddr = 0x%.16llx\n", vaddr);
+    xa_dbprint("--PTLookup: cr3 = 0x%.8llx\n", cr3);
+    pml4e = get_pml4e(instance, vaddr, cr3);
+    xa_dbprint("--PTLookup: pml4e = 0x%.16llx\n", pml4e);
+    if (!entry_present(pml4e)){
+        return paddr;
+    }
+    pdpe = get_pdpe_ia32e(instance, vaddr, pml4e);
+    xa_dbprint("--PTLookup: pdpe = 0x%.16llx\n", pdpe);
+    if (!entry_present(pdpe)){
+        return paddr;
+    }
+    if (page_size_flag(pdpe)){
+        paddr = get_huge_paddr_ia32e(vaddr, pdpe);
+        xa_dbprint("--PTLookup: 1GB page\n");
+        return paddr;
+    }
+    pgd = get_pgd_pae(instance, vaddr, pdpe);
+    xa_dbprint("--PTLookup: pgd = 0x%.16llx\n", pgd);
+
+    if (entry_present(pgd)){
+        if (page_size_flag(pgd)){
+            paddr = get_large_paddr_pae(vaddr, pgd);
+            xa_dbprint("--PTLookup: 2MB page\n");
+        }
+        else{
+            pte = get_pte_pae(instance, vaddr, pgd);
+            xa_dbprint("--PTLookup: pte = 0x%.16llx\n", pte);
+            if (entry_present(pte) || entry_transition(instance, pte)){
+                paddr = get_paddr_pae(vaddr, pte);
+            }
+        }
+    }
+    xa_dbprint("--PTLookup: paddr = 0x%.8llx\n", paddr);
+    return paddr;
+}
+
+void xa_set_paging_mode (xa_instance_t *instance)
+{
+    if (instance->ia32e){
+        instance->v2p = v2p_ia32e;
+    }
+    else if (instance->pae){
+        instance->v2p = v2p_pae;
+    }
+    else if (instance->pse){
+        instance->v2p = v2p_nopae_pse;
+    }
+    else{
+        instance->v2p = v2p_nopae_4k;
+    }
+}
+
 /* convert address to machine address via page tables */
-uint32_t xa_pagetable_lookup (
+uint64_t xa_pagetable_lookup (
+            xa_instance_t *instance,
+            uint64_t cr3,
+            xa_addr_t vaddr)
+{
+    instance->stats.page_walks++;
+    return instance->v2p(instance, cr3, vaddr);
+}
+
+void xa_walk_init (xa_walk_state_t *walk, uint64_t cr3)
+{
+    walk->cr3 = cr3;
+    walk->pml4e_valid = 0;
+    walk->pml4e_key = 0;
+    walk->pml4e = 0;
+    walk->pdpe_valid = 0;
+    walk->pdpe_key = 0;
+    walk->pdpe = 0;
+    walk->pde_valid = 0;
+    walk->pde_key = 0;
+    walk->pde = 0;
+    walk->pde_shift = 12;
+    walk->pte = 0;
+}
+
+/* size of the page found by the last lookup with this walk state */
+uint32_t xa_walk_page_shift (xa_instance_t *instance, xa_walk_state_t *walk)
+{
+    if (walk->pde_valid && entry_present(walk->pde) &&
+        page_size_flag(walk->pde)){
+        return walk->pde_shift;
+    }
+    return 12;
+}
+
+/* translates an address in the Linux lowmem map without a page walk,
+   see xa_set_direct_map */
+static int xa_direct_map_lookup (
+        xa_instance_t *instance, xa_addr_t vaddr, uint64_t *maddr)
+{
+    unsigned long mfn = 0;
+
+    if (vaddr < instance->page_offset || vaddr >= instance->direct_map_end){
+        return 0;
+    }
+    mfn = instance->backend->pfn_to_mfn(
+        instance, (vaddr - instance->page_offset) >> instance->page_shift);
+    if (-1 == mfn){
+        return 0;
+    }
+    *maddr = ((uint64_t) mfn << instance->page_shift) |
+        (vaddr & (instance->page_size - 1));
+    return 1;
+}
+
+/* loads the directory entry for vaddr into the walk state */
+static uint64_t xa_walk_pde (
             xa_instance_t *instance,
-            uint32_t cr3,
-            uint32_t vaddr)
+            xa_walk_state_t *walk,
+            xa_addr_t vaddr)
 {
+    xa_addr_t key = 0;
+
+    /* long mode also has CR4.PAE set, so test for it first */
+    if (instance->ia32e){
+        key = vaddr >> 21;
+        if (!walk->pde_valid || walk->pde_key != key){
+            if (!walk->pdpe_valid || walk->pdpe_key != (vaddr >> 30)){
+                if (!walk->pml4e_valid || walk->pml4e_key != (vaddr >> 39)){
+                    walk->pml4e = get_pml4e(instance, vaddr, walk->cr3);
+                    walk->pml4e_key = vaddr >> 39;
+                    walk->pml4e_valid = 1;
+                }
+                if (!entry_present(walk->pml4e)){
+                    walk->pdpe = 0;
+                }
+                else{
+                    walk->pdpe = get_pdpe_ia32e(instance, vaddr, walk->pml4e);
+                }
+                walk->pdpe_key = vaddr >> 30;
+                walk->pdpe_valid = 1;
+            }
+            walk->pde_shift = 21;
+            if (!entry_present(walk->pdpe)){
+                walk->pde = 0;
+            }
+            else if (page_size_flag(walk->pdpe)){
+                /* a 1GB page stands in for the directory entry */
+                walk->pde = walk->pdpe;
+                walk->pde_shift = 30;
+            }
+            else{
+                walk->pde = get_pgd_pae(instance, vaddr, walk->pdpe);
+            }
+            walk->pde_key = key;
+            walk->pde_valid = 1;
+        }
+    }
+    else if (instance->pae){
+        key = vaddr >> 21;
+        if (!walk->pde_valid || walk->pde_key != key){
+            if (!walk->pdpe_valid || walk->pdpe_key != (vaddr >> 30)){
+                walk->pdpe = get_pdpi(instance, vaddr, walk->cr3);
+                walk->pdpe_key = vaddr >> 30;
+                walk->pdpe_valid = 1;
+            }
+            if (!entry_present(walk->pdpe)){
+                walk->pde = 0;
+            }
+            else{
+                walk->pde = get_pgd_pae(instance, vaddr, walk->pdpe);
+            }
+            walk->pde_shift = 21;
+            walk->pde_key = key;
+            walk->pde_valid = 1;
+        }
+    }
+    else{
+        key = vaddr >> 22;
+        if (!walk->pde_valid || walk->pde_key != key){
+            walk->pde = get_pgd_nopae(instance, vaddr, walk->cr3);
+
+            /* without PSE the CPU ignores the page size bit, so drop it
+               here and every user of the walk sees a page table */
+            if (!instance->pse){
+                walk->pde &= ~0x80ULL;
+            }
+            walk->pde_shift = 22;
+            walk->pde_key = key;
+            walk->pde_valid = 1;
+        }
+    }
+    return walk->pde;
+}
+
+/* translates vaddr with a page table entry that has already been read */
+static int xa_walk_pte_paddr (
+            xa_instance_t *instance, xa_addr_t vaddr, uint64_t pte,
+            uint64_t *paddr)
+{
+    if (!entry_present(pte) && !entry_transition(instance, pte)){
+        *paddr = 0;
+        return XA_FAILURE;
+    }
     if (instance->pae){
-        return v2p_pae(instance, cr3, vaddr);
+        *paddr = get_paddr_pae(vaddr, pte);
     }
     else{
-        return v2p_nopae(instance, cr3, vaddr);
+        *paddr = get_paddr_nopae(vaddr, (uint32_t) pte);
     }
+    return XA_SUCCESS;
 }
 
-uint32_t xa_current_cr3 (xa_instance_t *instance, uint32_t *cr3)
+/* translates vaddr within the large page loaded by xa_walk_pde */
+static uint64_t xa_walk_large_paddr (
+            xa_instance_t *instance, xa_walk_state_t *walk, xa_addr_t vaddr)
 {
-    int ret = XA_SUCCESS;
-#ifdef ENABLE_XEN
-#ifdef HAVE_CONTEXT_ANY
-    vcpu_guest_context_any_t ctxt_any;
-#endif /* HAVE_CONTEXT_ANY */
-    vcpu_guest_context_t ctxt;
-#endif /* ENABLE_XEN */
+    if (30 == walk->pde_shift){
+        return get_huge_paddr_ia32e(vaddr, walk->pde);
+    }
+    return get_large_paddr(instance, vaddr, walk->pde);
+}
 
-    if (XA_MODE_XEN == instance->mode){
-#ifdef ENABLE_XEN
-#ifdef HAVE_CONTEXT_ANY
-        if ((ret = xc_vcpu_getcontext(
-                instance->m.xen.xc_handle,
-                instance->m.xen.domain_id,
-                0, /*TODO vcpu, assuming only 1 for now */
-                &ctxt_any)) != 0){
-#else
-        if ((ret = xc_vcpu_getcontext(
-                instance->m.xen.xc_handle,
-                instance->m.xen.domain_id,
-                0, /*TODO vcpu, assuming only 1 for now */
-                &ctxt)) != 0){
-#endif /* HAVE_CONTEXT_ANY */
-            fprintf(stderr, "ERROR: failed to get context information.\n");
-            ret = XA_FAILURE;
-            goto error_exit;
+/* like xa_walk_lookup, but a page at physical address 0 can be told
+   apart from an address that isn't mapped */
+static int xa_walk_translate (
+            xa_instance_t *instance,
+            xa_walk_state_t *walk,
+            xa_addr_t vaddr,
+            uint64_t *paddr)
+{
+    uint64_t pde = 0;
+    uint64_t pte = 0;
+
+    /* lowmem is mapped the same way in every address space */
+    walk->pte = 0;
+    if (xa_direct_map_lookup(instance, vaddr, paddr)){
+        return XA_SUCCESS;
+    }
+
+    instance->stats.page_walks++;
+    pde = xa_walk_pde(instance, walk, vaddr);
+    if (!entry_present(pde)){
+        *paddr = 0;
+        return XA_FAILURE;
+    }
+    if (page_size_flag(pde)){
+        *paddr = xa_walk_large_paddr(instance, walk, vaddr);
+        return XA_SUCCESS;
+    }
+
+    if (instance->pae){
+        pte = get_pte_pae(instance, vaddr, pde);
+    }
+    else{
+        pte = get_pte_nopae(instance, vaddr, pde);
+    }
+    walk->pte = pte;
+    return xa_walk_pte_paddr(instance, vaddr, pte, paddr);
+}
+
+uint64_t xa_walk_lookup (
+            xa_instance_t *instance,
+            xa_walk_state_t *walk,
+            xa_addr_t vaddr)
+{
+    uint64_t paddr = 0;
+
+    xa_walk_translate(instance, walk, vaddr, &paddr);
+    return paddr;
+}
+
+/* gets the pagefile copy of a page that the last lookup with this walk
+   state found to be paged out, see xa_set_pagefile */
+static void *xa_walk_pagefile_page (
+            xa_instance_t *instance, xa_walk_state_t *walk)
+{
+    uint64_t page = 0;
+
+    /* only the first pagefile can be given to us */
+    if (NULL == instance->pagefile ||
+        entry_pagefile(instance, walk->pte, &page) != 0){
+        return NULL;
+    }
+    return xa_pagefile_map_page(instance, page);
+}
+
+/* watches the paging structure pages used by the last lookup with this
+   walk state, so that a TLB entry for it can be dropped when one of
+   them changes, see xa_invalidate */
+static void xa_walk_tags (
+            xa_instance_t *instance, xa_walk_state_t *walk,
+            uint32_t tags[XA_PT_LEVELS])
+{
+    uint64_t mask = 0xFFFFFFFFFF000ULL;
+    int large = page_size_flag(walk->pde);
+    int n = 0;
+
+    memset(tags, 0, XA_PT_LEVELS * sizeof(uint32_t));
+    if (0 == instance->tlb_size){
+        return;
+    }
+
+    /* a failed walk stops at the first entry that isn't present */
+    tags[n++] = xa_watch_page(instance, walk->cr3 >> 12);
+    if (instance->ia32e){
+        if (!entry_present(walk->pml4e)){
+            return;
         }
-#ifdef HAVE_CONTEXT_ANY
-        *cr3 = ctxt_any.c.ctrlreg[3] & 0xFFFFF000;
-#else
-        *cr3 = ctxt.ctrlreg[3] & 0xFFFFF000;
-#endif /* HAVE_CONTEXT_ANY */
-#endif /* ENABLE_XEN */
+        tags[n++] = xa_watch_page(instance, (walk->pml4e & mask) >> 12);
+        if (30 != walk->pde_shift && entry_present(walk->pdpe)){
+            tags[n++] = xa_watch_page(instance, (walk->pdpe & mask) >> 12);
+        }
+    }
+    else if (instance->pae && entry_present(walk->pdpe)){
+        tags[n++] = xa_watch_page(instance, (walk->pdpe & mask) >> 12);
     }
-    else if (XA_MODE_FILE == instance->mode){
+    if (!large && entry_present(walk->pde)){
+        tags[n++] = xa_watch_page(instance, (walk->pde & mask) >> 12);
+    }
+}
+
+/* size of the unmapped region around the address given to the last
+   failed xa_walk_lookup with this walk state */
+static uint32_t xa_walk_hole_shift (
+            xa_instance_t *instance, xa_walk_state_t *walk)
+{
+    if (instance->ia32e && !entry_present(walk->pml4e)){
+        return 39;
+    }
+    if ((instance->ia32e || instance->pae) && !entry_present(walk->pdpe)){
+        return 30;
+    }
+    if (!entry_present(walk->pde)){
+        return walk->pde_shift;
+    }
+    return 12;
+}
+
+/* one address of a batch translation, see xa_translate_batch */
+struct xa_batch_item{
+    xa_addr_t vaddr;
+    uint32_t index;
+};
+
+static int xa_batch_item_compare (const void *a, const void *b)
+{
+    xa_addr_t va = ((const struct xa_batch_item *) a)->vaddr;
+    xa_addr_t vb = ((const struct xa_batch_item *) b)->vaddr;
+    return (va > vb) - (va < vb);
+}
+
+uint32_t xa_translate_batch (
+        xa_instance_t *instance, uint64_t cr3,
+        const xa_addr_t *vaddrs, uint64_t *paddrs, int *status, uint32_t n)
+{
+    struct xa_batch_item *items = NULL;
+    unsigned char *memory = NULL;
+    xa_walk_state_t walk;
+    uint64_t pde = 0;
+    uint64_t pte = 0;
+    uint32_t offset = 0;
+    uint32_t found = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    int ret = XA_FAILURE;
+
+    xa_walk_init(&walk, cr3);
+
+    /* without room to sort, translate in the given order */
+    items = malloc(n * sizeof(struct xa_batch_item));
+    if (NULL == items){
+        for (i = 0; i < n; ++i){
+            ret = xa_walk_translate(instance, &walk, vaddrs[i], &paddrs[i]);
+            if (status){
+                status[i] = ret;
+            }
+            found += (XA_SUCCESS == ret);
+        }
+        return found;
+    }
+
+    /* sorting groups the addresses that share a page table */
+    for (i = 0; i < n; ++i){
+        items[i].vaddr = vaddrs[i];
+        items[i].index = i;
+    }
+    qsort(items, n, sizeof(struct xa_batch_item), xa_batch_item_compare);
+
+    for (i = 0; i < n; i = j){
+        xa_addr_t vaddr = items[i].vaddr;
+        uint32_t shift = instance->pae ? 21 : 22;
+
+        /* items i..j-1 are all under the same directory entry */
+        for (j = i + 1; j < n && (items[j].vaddr >> shift) ==
+                                 (vaddr >> shift); ++j);
+
+        pde = xa_walk_pde(instance, &walk, vaddr);
+        memory = NULL;
+        if (entry_present(pde) && !page_size_flag(pde)){
+            memory = xa_access_ma(instance,
+                instance->pae ? ptba_base_pae(pde) : ptba_base_nopae(pde),
+                &offset, PROT_READ);
+        }
+
+        for (; i < j; ++i){
+            uint64_t *paddr = &paddrs[items[i].index];
+
+            vaddr = items[i].vaddr;
+            if (!entry_present(pde)){
+                *paddr = 0;
+                ret = XA_FAILURE;
+            }
+            else if (page_size_flag(pde)){
+                *paddr = xa_walk_large_paddr(instance, &walk, vaddr);
+                ret = XA_SUCCESS;
+            }
+            else if (memory){
+                pte = 0;
+                memcpy(&pte, memory + offset + pte_index(instance, vaddr),
+                       instance->pae ? sizeof(uint64_t) : sizeof(uint32_t));
+                ret = xa_walk_pte_paddr(instance, vaddr, pte, paddr);
+            }
+            else{
+                ret = xa_walk_translate(instance, &walk, vaddr, paddr);
+            }
+            if (status){
+                status[items[i].index] = ret;
+            }
+            found += (XA_SUCCESS == ret);
+        }
+
+        if (memory){
+            xa_munmap(instance, memory, instance->page_size);
+        }
+    }
+
+    free(items);
+    return found;
+}
+
+uint32_t xa_current_cr3 (xa_instance_t *instance, uint64_t *cr3)
+{
+    int ret = XA_SUCCESS;
+    uint64_t value = 0;
+
+    /* without live registers, use the kernel page directory */
+    if (NULL == instance->backend->get_vcpureg){
         *cr3 = instance->kpgd - instance->page_offset;
     }
+    /*TODO vcpu, assuming only 1 for now */
+    else if (instance->backend->get_vcpureg(
+                instance, XA_REG_CR3, 0, &value) == XA_SUCCESS){
+        *cr3 = value & (instance->ia32e ? 0xFFFFFFFFFF000ULL : 0xFFFFF000);
+    }
+    else{
+        fprintf(stderr, "ERROR: failed to get context information.\n");
+        ret = XA_FAILURE;
+    }
 
-error_exit:
     return ret;
 }
 
 /* expose virtual to physical mapping via api call */
-uint32_t xa_translate_kv2p(xa_instance_t *instance, uint32_t virt_address)
+uint64_t xa_translate_kv2p(xa_instance_t *instance, xa_addr_t virt_address)
 {
-    uint32_t cr3 = 0;
+    uint64_t cr3 = 0;
+    uint64_t address = 0;
+
+    if (xa_direct_map_lookup(instance, virt_address, &address)){
+        return address;
+    }
     xa_current_cr3(instance, &cr3);
     return xa_pagetable_lookup(instance, cr3, virt_address);
 }
@@ -492,10 +1017,10 @@ void *xa_access_kernel_sym (
 }
 
 /* finds the address of the page global directory for a given pid */
-uint32_t xa_pid_to_pgd (xa_instance_t *instance, int pid)
+uint64_t xa_pid_to_pgd (xa_instance_t *instance, int pid)
 {
     /* first check the cache */
-    uint32_t pgd = 0;
+    uint64_t pgd = 0;
     if (xa_check_pid_cache(instance, pid, &pgd)){
         /* nothing */
     }
@@ -511,67 +1036,160 @@ uint32_t xa_pid_to_pgd (xa_instance_t *instance, int pid)
     return pgd;
 }
 
+int xa_for_each_process (
+        xa_instance_t *instance, xa_process_cb_t cb, void *ctx)
+{
+    if (XA_OS_LINUX == instance->os_type){
+        return linux_for_each_process(instance, cb, ctx);
+    }
+    else if (XA_OS_WINDOWS == instance->os_type){
+        return windows_for_each_process(instance, cb, ctx);
+    }
+    else{
+        return XA_FAILURE;
+    }
+}
+
+int xa_set_direct_map (xa_instance_t *instance, int enable)
+{
+    if (!enable){
+        instance->direct_map_end = 0;
+        return XA_SUCCESS;
+    }
+    if (XA_OS_LINUX != instance->os_type){
+        fprintf(stderr, "ERROR: direct map is only available for Linux\n");
+        return XA_FAILURE;
+    }
+
+    /* high_memory must be read through the page tables */
+    instance->direct_map_end = 0;
+    instance->direct_map_end = linux_lowmem_end(instance);
+    xa_dbprint("**set instance->direct_map_end (0x%.8x).\n",
+        instance->direct_map_end);
+    return instance->direct_map_end ? XA_SUCCESS : XA_FAILURE;
+}
+
+int xa_set_address_size (xa_instance_t *instance, uint32_t bits)
+{
+    if (64 != bits && 32 != bits){
+        fprintf(stderr, "ERROR: unsupported address size %u\n", bits);
+        return XA_FAILURE;
+    }
+
+    /* long mode always uses PAE entries */
+    instance->ia32e = (64 == bits);
+    if (instance->ia32e){
+        instance->pae = 1;
+    }
+    xa_set_paging_mode(instance);
+    xa_flush_tlb(instance);
+    xa_dbprint("**set instance->ia32e = %d\n", instance->ia32e);
+    return XA_SUCCESS;
+}
+
 void *xa_access_user_va (
         xa_instance_t *instance,
-        uint32_t virt_address,
+        xa_addr_t virt_address,
         uint32_t *offset,
         int pid,
         int prot)
 {
-    uint32_t address = 0;
+    uint64_t address = 0;
+    void *memory = NULL;
+    uint32_t tags[XA_PT_LEVELS];
+    xa_walk_state_t walk;
 
-    /* check the LRU cache */
-    if (xa_check_cache_virt(instance, virt_address, pid, &address)){
+    /* lowmem needs neither the TLB nor a walk */
+    if (xa_direct_map_lookup(instance, virt_address, &address)){
         return xa_access_ma(instance, address, offset, prot);
     }
 
+    /* check the TLB */
+    if (xa_check_tlb(instance, virt_address, pid, &address)){
+        return xa_access_ma(instance, address, offset, prot);
+    }
+
+    /* a hole that was probed recently is still a hole */
+    if (xa_check_neg_cache(instance, virt_address, pid) &&
+        (PROT_READ != prot || NULL == instance->pagefile)){
+        xa_dbprint("--UserVirt: address not in page table (0x%llx)\n",
+            virt_address);
+        return NULL;
+    }
+
     /* use kernel page tables */
     /*TODO HYPERVISOR_VIRT_START = 0xFC000000 so we can't go over that.
       Figure out what this should be b/c there still may be a fixed
       mapping range between the page'd addresses and VIRT_START */
     if (!pid){
-        uint32_t cr3 = 0;
+        uint64_t cr3 = 0;
         xa_current_cr3(instance, &cr3);
-        address = xa_pagetable_lookup(instance, cr3, virt_address);
-        if (!address){
-            fprintf(stderr, "ERROR: address not in page table (0x%x)\n", virt_address);
-            return NULL;
-        }
+        xa_walk_init(&walk, cr3);
+        address = xa_walk_lookup(instance, &walk, virt_address);
     }
 
     /* use user page tables */
     else{
-        uint32_t pgd = xa_pid_to_pgd(instance, pid);
-        xa_dbprint("--UserVirt: pgd for pid=%d is 0x%.8x.\n", pid, pgd);
+        uint64_t pgd = xa_pid_to_pgd(instance, pid);
+        xa_dbprint("--UserVirt: pgd for pid=%d is 0x%.8llx.\n", pid, pgd);
 
+        xa_walk_init(&walk, pgd);
         if (pgd){
-            address = xa_pagetable_lookup(instance, pgd, virt_address);
+            address = xa_walk_lookup(instance, &walk, virt_address);
         }
+    }
 
-        if (!address){
-            fprintf(stderr, "ERROR: address not in page table (0x%x)\n", virt_address);
-            return NULL;
+    if (!address){
+        /* a paged out page may still be read from the pagefile */
+        if (PROT_READ == prot &&
+            NULL != (memory = xa_walk_pagefile_page(instance, &walk))){
+            *offset = virt_address & (instance->page_size - 1);
+            return memory;
+        }
+        /* scanners probe holes all the time, so the caller decides
+           whether a NULL is worth reporting */
+        xa_dbprint("--UserVirt: address not in page table (0x%llx)\n",
+            (unsigned long long) virt_address);
+
+        /* remember the hole, but not a process that couldn't be found */
+        if (walk.cr3){
+            xa_walk_tags(instance, &walk, tags);
+            xa_update_neg_cache(instance, virt_address, pid,
+                xa_walk_hole_shift(instance, &walk), tags);
         }
+        return NULL;
     }
 
-    /* update cache and map the memory */
-    xa_update_cache(instance, NULL, virt_address, pid, address);
+    /* update the TLB and map the memory */
+    xa_walk_tags(instance, &walk, tags);
+    xa_update_tlb(instance, virt_address, pid, address,
+        xa_walk_page_shift(instance, &walk), tags);
     return xa_access_ma(instance, address, offset, prot);
 }
 
-/*TODO find a way to support this in file mode */
 void *xa_access_user_va_range (
         xa_instance_t *instance,
-        uint32_t virt_address,
+        xa_addr_t virt_address,
 		uint32_t size,
         uint32_t *offset,
         int pid,
         int prot)
 {
-#ifdef ENABLE_XEN
     int i = 0;
-    uint32_t num_pages = size / instance->page_size + 1;
-    uint32_t pgd = 0;
+    xa_addr_t start = virt_address & ~((xa_addr_t) instance->page_size - 1);
+    uint32_t num_pages = 0;
+    uint64_t pgd = 0;
+    xa_addr_t addr = 0;
+    uint64_t maddr = 0;
+    unsigned long *frames = NULL;
+    void *memory = NULL;
+    xa_walk_state_t walk;
+
+    if (0 == size){
+        size = 1;
+    }
+    num_pages = ((virt_address + size - 1) >> instance->page_shift) -
+                (virt_address >> instance->page_shift) + 1;
 
     if (pid){
         pgd = xa_pid_to_pgd(instance, pid);
@@ -579,37 +1197,302 @@ void *xa_access_user_va_range (
     else{
         xa_current_cr3(instance, &pgd);
     }
-    xen_pfn_t* pfns = (xen_pfn_t*) malloc(sizeof(xen_pfn_t) * num_pages);
-	
-    uint32_t start = virt_address & ~(instance->page_size - 1);
+    xa_walk_init(&walk, pgd);
+
+    frames = malloc(sizeof(unsigned long) * num_pages);
+    if (NULL == frames){
+        return NULL;
+    }
+
     for (i = 0; i < num_pages; i++){
         /* Virtual address for each page we will map */
-        uint32_t addr = start + i * instance->page_size;
-	
-        if(!addr) {
-            fprintf(stderr, "ERROR: address not in page table (%p)\n", addr);
-            return NULL;
-        }
+        addr = start + i * instance->page_size;
 
-        /* Physical page frame number of each page */
-        pfns[i] = xa_pagetable_lookup(
-            instance, pgd, addr) >> instance->page_shift;
+        /* Machine frame number of each page */
+        maddr = xa_walk_lookup(instance, &walk, addr);
+        if (!maddr){
+            fprintf(stderr, "ERROR: address not in page table (0x%llx)\n",
+                (unsigned long long) addr);
+            goto error_exit;
+        }
+        frames[i] = maddr >> instance->page_shift;
     }
 
     *offset = virt_address - start;
+    memory = xa_map_pages(instance, prot, frames, num_pages);
 
-    return xc_map_foreign_pages(
-        instance->m.xen.xc_handle,
-        instance->m.xen.domain_id, prot, pfns, num_pages
-    );
-#else
-    return NULL;
-#endif /* ENABLE_XEN */
+error_exit:
+    free(frames);
+    return memory;
+}
+
+uint32_t xa_read_va (
+        xa_instance_t *instance,
+        int pid,
+        xa_addr_t virt_address,
+        void *buf,
+        uint32_t count)
+{
+    unsigned char *memory = NULL;
+    uint64_t pgd = 0;
+    uint64_t paddr = 0;
+    uint32_t offset = 0;
+    uint32_t chunk = 0;
+    uint32_t done = 0;
+    xa_walk_state_t walk;
+
+    if (pid){
+        pgd = xa_pid_to_pgd(instance, pid);
+        if (!pgd){
+            return 0;
+        }
+    }
+    else{
+        xa_current_cr3(instance, &pgd);
+    }
+    xa_walk_init(&walk, pgd);
+
+    while (done < count){
+        paddr = xa_walk_lookup(instance, &walk, virt_address + done);
+        if (paddr){
+            memory = xa_access_ma(instance, paddr, &offset, PROT_READ);
+        }
+        else{
+            memory = xa_walk_pagefile_page(instance, &walk);
+            offset = (virt_address + done) & (instance->page_size - 1);
+            if (NULL == memory){
+                xa_dbprint("--ReadVA: stopping at unmapped address 0x%.8llx\n",
+                    virt_address + done);
+            }
+        }
+        if (NULL == memory){
+            break;
+        }
+
+        chunk = instance->page_size - offset;
+        if (chunk > count - done){
+            chunk = count - done;
+        }
+        memcpy((unsigned char *) buf + done, memory + offset, chunk);
+        xa_munmap(instance, memory, instance->page_size);
+        done += chunk;
+    }
+
+    instance->stats.bytes_read += done;
+    return done;
+}
+
+/* collects adjacent mappings into runs for xa_walk_address_space */
+struct xa_run{
+    xa_mapping_cb_t cb;
+    void *ctx;
+    xa_addr_t vstart;
+    uint64_t pstart;
+    uint64_t length;
+};
+
+/* adds a mapping to the current run, or reports the run and starts a new
+   one if the mapping does not continue it.  returns nonzero to stop. */
+static int xa_run_add (
+        xa_instance_t *instance, struct xa_run *run,
+        uint64_t vaddr, uint64_t paddr, uint64_t length)
+{
+    int ret = 0;
+
+    if (run->length &&
+        run->vstart + run->length == vaddr &&
+        run->pstart + run->length == paddr){
+        run->length += length;
+        return 0;
+    }
+    if (run->length){
+        ret = run->cb(instance, run->vstart,
+            run->pstart, run->length, run->ctx);
+    }
+    run->vstart = vaddr;
+    run->pstart = paddr;
+    run->length = length;
+    return ret;
+}
+
+/* walks one page table, whose entries are entry_size bytes */
+static int xa_walk_page_table (
+        xa_instance_t *instance, struct xa_run *run,
+        uint64_t table, uint64_t vbase, uint32_t entry_size)
+{
+    unsigned char *memory = NULL;
+    uint32_t offset = 0;
+    uint32_t i = 0;
+    uint64_t pte = 0;
+    int ret = 0;
+
+    memory = xa_access_ma(instance, table, &offset, PROT_READ);
+    if (NULL == memory){
+        return 0;
+    }
+    for (i = 0; i < instance->page_size / entry_size && !ret; ++i){
+        if (8 == entry_size){
+            pte = *((uint64_t *)(memory + i * 8));
+        }
+        else{
+            pte = *((uint32_t *)(memory + i * 4));
+        }
+        if (!entry_present(pte)){
+            continue;
+        }
+        ret = xa_run_add(instance, run, vbase + ((uint64_t) i << 12),
+            (8 == entry_size) ? pte_pfn_pae(pte) : pte_pfn_nopae(pte),
+            1ULL << 12);
+    }
+    xa_munmap(instance, memory, instance->page_size);
+    return ret;
+}
+
+/* walks one page directory, whose entries are entry_size bytes */
+static int xa_walk_page_directory (
+        xa_instance_t *instance, struct xa_run *run,
+        uint64_t directory, uint64_t vbase, uint32_t entry_size)
+{
+    unsigned char *memory = NULL;
+    uint32_t offset = 0;
+    uint32_t shift = (8 == entry_size) ? 21 : 22;
+    uint32_t i = 0;
+    uint64_t pde = 0;
+    uint64_t vaddr = 0;
+    int ret = 0;
+
+    memory = xa_access_ma(instance, directory, &offset, PROT_READ);
+    if (NULL == memory){
+        return 0;
+    }
+    for (i = 0; i < instance->page_size / entry_size && !ret; ++i){
+        if (8 == entry_size){
+            pde = *((uint64_t *)(memory + i * 8));
+        }
+        else{
+            pde = *((uint32_t *)(memory + i * 4));
+        }
+        if (!entry_present(pde)){
+            continue;
+        }
+        vaddr = vbase + ((uint64_t) i << shift);
+        if (page_size_flag(pde) && (8 == entry_size || instance->pse)){
+            ret = xa_run_add(instance, run, vaddr,
+                get_large_paddr(instance, 0, pde), 1ULL << shift);
+        }
+        else if (8 == entry_size){
+            ret = xa_walk_page_table(
+                instance, run, ptba_base_pae(pde), vaddr, entry_size);
+        }
+        else{
+            ret = xa_walk_page_table(
+                instance, run, ptba_base_nopae(pde), vaddr, entry_size);
+        }
+    }
+    xa_munmap(instance, memory, instance->page_size);
+    return ret;
+}
+
+/* walks one IA-32e page directory pointer table, whose entries may map
+   1GB pages */
+static int xa_walk_pdpt (
+        xa_instance_t *instance, struct xa_run *run,
+        uint64_t table, uint64_t vbase)
+{
+    unsigned char *memory = NULL;
+    uint32_t offset = 0;
+    uint32_t i = 0;
+    uint64_t pdpe = 0;
+    uint64_t vaddr = 0;
+    int ret = 0;
+
+    memory = xa_access_ma(instance, table, &offset, PROT_READ);
+    if (NULL == memory){
+        return 0;
+    }
+    for (i = 0; i < instance->page_size / 8 && !ret; ++i){
+        pdpe = *((uint64_t *)(memory + i * 8));
+        if (!entry_present(pdpe)){
+            continue;
+        }
+        vaddr = vbase + ((uint64_t) i << 30);
+        if (page_size_flag(pdpe)){
+            ret = xa_run_add(instance, run, vaddr,
+                get_huge_paddr_ia32e(0, pdpe), 1ULL << 30);
+        }
+        else{
+            ret = xa_walk_page_directory(
+                instance, run, pdba_base_pae(pdpe), vaddr, sizeof(uint64_t));
+        }
+    }
+    xa_munmap(instance, memory, instance->page_size);
+    return ret;
+}
+
+int xa_walk_address_space (
+        xa_instance_t *instance, uint64_t cr3,
+        xa_mapping_cb_t cb, void *ctx)
+{
+    struct xa_run run;
+    unsigned char *memory = NULL;
+    uint32_t offset = 0;
+    uint64_t vbase = 0;
+    uint64_t pdpe = 0;
+    uint64_t pml4e = 0;
+    uint32_t i = 0;
+    int ret = 0;
+
+    run.cb = cb;
+    run.ctx = ctx;
+    run.length = 0;
+
+    if (instance->ia32e){
+        memory = xa_access_ma(instance, get_pml4tb(cr3), &offset, PROT_READ);
+        if (NULL == memory){
+            return XA_FAILURE;
+        }
+        for (i = 0; i < 512 && !ret; ++i){
+            pml4e = *((uint64_t *)(memory + i * 8));
+            if (!entry_present(pml4e)){
+                continue;
+            }
+
+            /* the upper half is sign extended to canonical form */
+            vbase = (uint64_t) i << 39;
+            if (i >= 256){
+                vbase |= 0xFFFF000000000000ULL;
+            }
+            ret = xa_walk_pdpt(
+                instance, &run, pdba_base_pae(pml4e), vbase);
+        }
+        xa_munmap(instance, memory, instance->page_size);
+    }
+    else if (instance->pae){
+        for (i = 0; i < 4 && !ret; ++i){
+            if (xa_read_long_long_mach(instance,
+                    get_pdptb(cr3) + i * sizeof(uint64_t), &pdpe) ==
+                    XA_FAILURE || !entry_present(pdpe)){
+                continue;
+            }
+            ret = xa_walk_page_directory(instance, &run,
+                pdba_base_pae(pdpe), (uint64_t) i << 30, sizeof(uint64_t));
+        }
+    }
+    else{
+        ret = xa_walk_page_directory(instance, &run,
+            pdba_base_nopae(cr3), 0, sizeof(uint32_t));
+    }
+
+    /* report the last run */
+    if (!ret && run.length){
+        ret = cb(instance, run.vstart, run.pstart, run.length, ctx);
+    }
+    return ret ? XA_FAILURE : XA_SUCCESS;
 }
 
 void *xa_access_kernel_va (
         xa_instance_t *instance,
-        uint32_t virt_address,
+        xa_addr_t virt_address,
         uint32_t *offset,
         int prot)
 {
@@ -618,7 +1501,7 @@ void *xa_access_kernel_va (
 
 void *xa_access_kernel_va_range (
 	xa_instance_t *instance,
-	uint32_t virt_address,
+	xa_addr_t virt_address,
 	uint32_t size,
 	uint32_t* offset,
     int prot)
@@ -629,7 +1512,7 @@ void *xa_access_kernel_va_range (
 
 void *xa_access_pa (
         xa_instance_t *instance,
-        uint32_t phys_address,
+        uint64_t phys_address,
         uint32_t *offset,
         int prot)
 {
@@ -648,7 +1531,7 @@ void *xa_access_pa (
 
 void *xa_access_ma (
         xa_instance_t *instance,
-        uint32_t mach_address,
+        uint64_t mach_address,
         uint32_t *offset,
         int prot)
 {
@@ -665,6 +1548,192 @@ void *xa_access_ma (
     return xa_mmap_mfn(instance, prot, mfn);
 }
 
+/* one page-sized piece of a vector read request */
+struct xa_read_piece{
+    uint64_t paddr;
+    unsigned char *buf;
+    uint32_t len;
+};
+
+static int xa_read_piece_compare (const void *a, const void *b)
+{
+    uint64_t pa = ((const struct xa_read_piece *) a)->paddr;
+    uint64_t pb = ((const struct xa_read_piece *) b)->paddr;
+    return (pa > pb) - (pa < pb);
+}
+
+int xa_read_pa_vector (
+        xa_instance_t *instance, const xa_iovec_t *reqs, uint32_t count)
+{
+    struct xa_read_piece *pieces = NULL;
+    unsigned char *memory = NULL;
+    unsigned long pfn = 0;
+    uint32_t nr_pieces = 0;
+    uint32_t nr_frames = 0;
+    uint64_t total = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    int ret = XA_SUCCESS;
+    unsigned long *frames = NULL;
+    unsigned char *batch = NULL;
+
+    /* split each request at page boundaries */
+    for (i = 0; i < count; ++i){
+        if (reqs[i].len){
+            nr_pieces += ((reqs[i].paddr + reqs[i].len - 1) >>
+                instance->page_shift) - (reqs[i].paddr >>
+                instance->page_shift) + 1;
+        }
+    }
+    if (0 == nr_pieces){
+        return XA_SUCCESS;
+    }
+    pieces = malloc(nr_pieces * sizeof(struct xa_read_piece));
+    if (NULL == pieces){
+        return XA_FAILURE;
+    }
+    for (i = 0, j = 0; i < count; ++i){
+        uint64_t paddr = reqs[i].paddr;
+        uint32_t left = reqs[i].len;
+        unsigned char *buf = reqs[i].buf;
+        while (left){
+            uint32_t chunk =
+                instance->page_size - (paddr & (instance->page_size - 1));
+            if (chunk > left){
+                chunk = left;
+            }
+            pieces[j].paddr = paddr;
+            pieces[j].buf = buf;
+            pieces[j].len = chunk;
+            total += chunk;
+            ++j;
+            paddr += chunk;
+            buf += chunk;
+            left -= chunk;
+        }
+    }
+
+    /* sort by address so that pieces in the same frame are adjacent */
+    qsort(pieces, nr_pieces, sizeof(struct xa_read_piece),
+        xa_read_piece_compare);
+    for (i = 0; i < nr_pieces; ++i){
+        if (0 == i || (pieces[i].paddr >> instance->page_shift) !=
+                      (pieces[i - 1].paddr >> instance->page_shift)){
+            ++nr_frames;
+        }
+    }
+    xa_dbprint("--ReadVector: %d requests, %d pieces, %d frames\n",
+        count, nr_pieces, nr_frames);
+
+    /* map every distinct frame with a single call into the backend,
+       unless the backend can already hand out pages directly */
+    if (NULL == instance->backend->direct_page && nr_frames > 1){
+        frames = malloc(nr_frames * sizeof(unsigned long));
+        if (NULL == frames){
+            goto batch_done;
+        }
+        for (i = 0, j = 0; i < nr_pieces; ++i){
+            pfn = pieces[i].paddr >> instance->page_shift;
+            if (0 == i ||
+                pfn != (pieces[i - 1].paddr >> instance->page_shift)){
+                frames[j] = instance->backend->pfn_to_mfn(instance, pfn);
+                if (-1 == frames[j]){
+                    goto batch_done;
+                }
+                ++j;
+            }
+        }
+        batch = xa_map_pages(instance, PROT_READ, frames, nr_frames);
+        if (NULL == batch){
+            goto batch_done;
+        }
+        for (i = 0, j = 0; i < nr_pieces; ++i){
+            pfn = pieces[i].paddr >> instance->page_shift;
+            if (i && pfn != (pieces[i - 1].paddr >> instance->page_shift)){
+                ++j;
+            }
+            memcpy(pieces[i].buf, batch + j * instance->page_size +
+                (pieces[i].paddr & (instance->page_size - 1)), pieces[i].len);
+        }
+        instance->backend->unmap(
+            instance, batch, nr_frames * instance->page_size);
+        instance->stats.page_unmaps++;
+        instance->stats.bytes_read += total;
+        free(frames);
+        free(pieces);
+        return XA_SUCCESS;
+
+batch_done:
+        /* fall back on mapping one frame at a time */
+        if (frames) free(frames);
+    }
+
+    /* map each distinct frame once, reusing it for all of its pieces */
+    for (i = 0; i < nr_pieces; ++i){
+        pfn = pieces[i].paddr >> instance->page_shift;
+        if (0 == i || pfn != (pieces[i - 1].paddr >> instance->page_shift)){
+            if (memory) xa_munmap(instance, memory, instance->page_size);
+            memory = xa_mmap_pfn(instance, PROT_READ, pfn);
+        }
+        if (NULL == memory){
+            memset(pieces[i].buf, 0, pieces[i].len);
+            ret = XA_FAILURE;
+            continue;
+        }
+        memcpy(pieces[i].buf,
+            memory + (pieces[i].paddr & (instance->page_size - 1)),
+            pieces[i].len);
+        instance->stats.bytes_read += pieces[i].len;
+    }
+    if (memory) xa_munmap(instance, memory, instance->page_size);
+
+    free(pieces);
+    return ret;
+}
+
+int xa_munmap (xa_instance_t *instance, void *memory, uint32_t length)
+{
+    if (NULL == memory){
+        return XA_SUCCESS;
+    }
+
+    /* cached pages stay mapped until they are evicted */
+    if (xa_release_page_cache(instance, memory)){
+        return XA_SUCCESS;
+    }
+    if (xa_release_pagefile_page(instance, memory)){
+        return XA_SUCCESS;
+    }
+
+    instance->stats.page_unmaps++;
+    return instance->backend->unmap(instance, memory, length);
+}
+
+int xa_read_pa (
+        xa_instance_t *instance, uint64_t phys_address,
+        void *buf, uint32_t count)
+{
+    if (instance->backend->read(instance, phys_address, buf, count) ==
+            XA_FAILURE){
+        return XA_FAILURE;
+    }
+    instance->stats.bytes_read += count;
+    return XA_SUCCESS;
+}
+
+uint64_t xa_next_data_page (xa_instance_t *instance, uint64_t paddr)
+{
+    uint64_t next = paddr;
+
+    if (NULL != instance->backend->next_data){
+        next = instance->backend->next_data(instance, paddr);
+    }
+
+    /* data may start part way into a page */
+    next &= ~((uint64_t) instance->page_size - 1);
+    return next > paddr ? next : paddr;
+}
+
 /* ------------------------------------------------------------------------ */
 /* The code below is experimental and needs some cleanup and optimization
  * before being ready for prime time.  This code is designed to search the
@@ -698,7 +1767,7 @@ int xa_kernel_pd_bitcount (uint32_t n)
     return ((count + (count >> 3)) & 030707070707) % 63;
 }
 
-int xa_kernel_pd_valid_entry (uint32_t value, uint32_t msize)
+int xa_kernel_pd_valid_entry (uint32_t value, uint64_t msize)
 {
     /* basic sanity checks */
     if (0xffffffff == value){
@@ -729,7 +1798,7 @@ int xa_kernel_pd_valid_entry (uint32_t value, uint32_t msize)
    directory entires have some similarity between then (same bits flipped on,
    pointing to similar areas in the kernel, etc).  we also penalize any pages
    that contain entries that are trivially not valid PDEs */
-int xa_kernel_pd_score (unsigned char *memory, uint32_t length, uint32_t msize)
+int xa_kernel_pd_score (unsigned char *memory, uint32_t length, uint64_t msize)
 {
     uint32_t offset = 0;
     uint32_t matches0 = 0;
@@ -813,7 +1882,7 @@ uint32_t xa_kernel_pd_checksum (xa_instance_t *instance, unsigned char *memory)
 /* returns the number of entries in this page that, if parsed as a PDE, point
    to the same pfn as the current page */
 int xa_kernel_pd_selfref(
-        xa_instance_t *instance, unsigned char *memory, uint32_t address)
+        xa_instance_t *instance, unsigned char *memory, uint64_t address)
 {
     uint32_t offset = 0;
     int selfref = 0;
@@ -839,8 +1908,8 @@ int xa_kernel_pd_selfref(
 /* entry point into the search algorithm, this is the function to call */
 uint32_t xa_find_kernel_pd (xa_instance_t *instance)
 {
-    uint32_t end = 0;
-    uint32_t address = 0;
+    uint64_t end = 0;
+    uint64_t address = 0;
     uint32_t offset = 0;
     int score = 0;
     int max_score = 0;
@@ -848,7 +1917,7 @@ uint32_t xa_find_kernel_pd (xa_instance_t *instance)
 
     /* this is used to hold a list of the candidate pages */
     struct candidates{
-        uint32_t address;
+        uint64_t address;
         uint32_t checksum;
         int score;
         int matches;
@@ -861,17 +1930,14 @@ uint32_t xa_find_kernel_pd (xa_instance_t *instance)
     candidates_t prev = NULL;
 
     /* get the size of the physical memory */
-    if (XA_MODE_XEN == instance->mode){
-#ifdef ENABLE_XEN
-        end = instance->m.xen.size;
-#endif /* ENABLE_XEN */
-    }
-    else if (XA_MODE_FILE == instance->mode){
-        end = instance->m.file.size;
-    }
+    end = instance->backend->get_size(instance);
 
     /* look for pages with similarity between entries */
     while (address < end){
+        address = xa_next_data_page(instance, address);
+        if (address >= end){
+            break;
+        }
         memory = xa_access_pa(instance, address, &offset, PROT_READ);
         score = xa_kernel_pd_score(memory, instance->page_size, end);
         if (0 < score){
@@ -883,7 +1949,7 @@ uint32_t xa_find_kernel_pd (xa_instance_t *instance)
             cur->address = 0;
         }
         if (NULL != memory){
-            munmap(memory, instance->page_size);
+            xa_munmap(instance, memory, instance->page_size);
         }
         address += instance->page_size;
     }
@@ -899,7 +1965,7 @@ uint32_t xa_find_kernel_pd (xa_instance_t *instance)
         memory = xa_access_pa(instance, cur->address, &offset, PROT_READ);
         cur->checksum = xa_kernel_pd_checksum(instance, memory);
         if (NULL != memory){
-            munmap(memory, instance->page_size);
+            xa_munmap(instance, memory, instance->page_size);
         }
     }
     for (cur = list; cur->address != 0; cur = cur->next){
@@ -949,7 +2015,7 @@ uint32_t xa_find_kernel_pd (xa_instance_t *instance)
             memory = xa_access_pa(instance, cur->address, &offset, PROT_READ);
             cur->selfref = xa_kernel_pd_selfref(instance, memory, cur->address);
             if (NULL != memory){
-                munmap(memory, instance->page_size);
+                xa_munmap(instance, memory, instance->page_size);
             }
         }
         /* remove the ones that didn't have selfrefs */
@@ -0,0 +1,134 @@
+/*
+ * The libxa library provides access to resources in domU machines.
+ *
+ * Copyright (C) 2005 - 2008  Bryan D. Payne (bryan@thepaynes.cc)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * --------------------
+ * This file contains the mock memory backend, which serves guest
+ * memory from a buffer in the calling process.  It allows the library
+ * to be exercised and benchmarked without a hypervisor or image file.
+ *
+ * File: xa_mock.c
+ *
+ * Author(s): Bryan D. Payne (bryan@thepaynes.cc)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "xenaccess.h"
+#include "xa_private.h"
+
+static int xa_mock_init (xa_instance_t *instance)
+{
+    if (NULL == instance->m.mock.memory){
+        fprintf(stderr, "ERROR: no memory given to mock backend\n");
+        return XA_FAILURE;
+    }
+    xa_dbprint("**set instance->m.mock.size = %llu\n", instance->m.mock.size);
+    return XA_SUCCESS;
+}
+
+static int xa_mock_destroy (xa_instance_t *instance)
+{
+    /* the buffer belongs to the caller */
+    instance->m.mock.memory = NULL;
+    instance->m.mock.size = 0;
+    return XA_SUCCESS;
+}
+
+static uint64_t xa_mock_get_size (xa_instance_t *instance)
+{
+    return instance->m.mock.size;
+}
+
+static unsigned long xa_mock_pfn_to_mfn (
+        xa_instance_t *instance, unsigned long pfn)
+{
+    return pfn;
+}
+
+static void *xa_mock_map_page (
+        xa_instance_t *instance, int prot, unsigned long frame_num)
+{
+    uint64_t address = (uint64_t) frame_num << instance->page_shift;
+
+    if (address >= instance->m.mock.size){
+        return NULL;
+    }
+    return instance->m.mock.memory + address;
+}
+
+static void *xa_mock_direct_page (
+        xa_instance_t *instance, unsigned long frame_num)
+{
+    return xa_mock_map_page(instance, PROT_READ, frame_num);
+}
+
+/* the buffer can only provide a contiguous view of contiguous frames */
+static void *xa_mock_map_pages (
+        xa_instance_t *instance, int prot,
+        const unsigned long *frames, uint32_t num)
+{
+    uint32_t i = 0;
+
+    for (i = 1; i < num; ++i){
+        if (frames[i] != frames[0] + i){
+            fprintf(stderr, "ERROR: mock backend can't map scattered frames\n");
+            return NULL;
+        }
+    }
+    if (((uint64_t) frames[0] + num) << instance->page_shift >
+        instance->m.mock.size){
+        return NULL;
+    }
+    return xa_mock_map_page(instance, prot, frames[0]);
+}
+
+static int xa_mock_unmap (
+        xa_instance_t *instance, void *memory, uint32_t length)
+{
+    return XA_SUCCESS;
+}
+
+static int xa_mock_read (
+        xa_instance_t *instance, uint64_t paddr, void *buf, uint32_t count)
+{
+    if (paddr >= instance->m.mock.size ||
+        count > instance->m.mock.size - paddr){
+        return XA_FAILURE;
+    }
+    memcpy(buf, instance->m.mock.memory + paddr, count);
+    return XA_SUCCESS;
+}
+
+struct xa_backend xa_mock_backend = {
+    .name = "mock",
+    .init = xa_mock_init,
+    .destroy = xa_mock_destroy,
+    .get_size = xa_mock_get_size,
+    .pfn_to_mfn = xa_mock_pfn_to_mfn,
+    .map_page = xa_mock_map_page,
+    .map_pages = xa_mock_map_pages,
+    .direct_page = xa_mock_direct_page,
+    .unmap = xa_mock_unmap,
+    .read = xa_mock_read,
+    .next_data = NULL,
+    .pause = NULL,
+    .resume = NULL,
+    .get_vcpureg = NULL
+};
@@ -0,0 +1,196 @@
+/*
+ * The libxa library provides access to resources in domU machines.
+ *
+ * Copyright (C) 2005 - 2008  Bryan D. Payne (bryan@thepaynes.cc)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * --------------------
+ * This file contains the access to a Windows pagefile image.  Pages
+ * that Windows has written out are read from a copy of pagefile.sys
+ * and kept in a small cache, since the same pages tend to be read
+ * many times while walking a process.
+ *
+ * File: xa_pagefile.c
+ *
+ * Author(s): Bryan D. Payne (bryan@thepaynes.cc)
+ */
+
+/* config.h selects 64-bit file offsets, so it must come first */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "xenaccess.h"
+#include "xa_private.h"
+
+int xa_set_pagefile (xa_instance_t *instance, char *filename)
+{
+    FILE *fhandle = NULL;
+    struct stat s;
+
+    xa_destroy_pagefile(instance);
+    if (NULL == filename){
+        return XA_SUCCESS;
+    }
+
+    fhandle = fopen(filename, "rb");
+    if (NULL == fhandle){
+        fprintf(stderr, "ERROR: failed to open pagefile %s\n", filename);
+        return XA_FAILURE;
+    }
+    if (fstat(fileno(fhandle), &s) == -1){
+        fprintf(stderr, "ERROR: failed to stat pagefile %s\n", filename);
+        fclose(fhandle);
+        return XA_FAILURE;
+    }
+
+    instance->pagefile = fhandle;
+    instance->pagefile_size = s.st_size;
+    xa_dbprint("**set instance->pagefile = %s (%llu bytes)\n",
+        filename, instance->pagefile_size);
+    return XA_SUCCESS;
+}
+
+/* finds a cached page, or the entry to load it into */
+static xa_pagefile_entry_t xa_pagefile_find (
+        xa_instance_t *instance, uint64_t page, int *found)
+{
+    xa_pagefile_entry_t empty = NULL;
+    xa_pagefile_entry_t oldest = NULL;
+    uint32_t i = 0;
+
+    *found = 0;
+    for (i = 0; i < XA_PAGEFILE_CACHE_SIZE; ++i){
+        xa_pagefile_entry_t entry = &instance->pagefile_cache[i];
+        if (NULL != entry->memory && entry->page == page){
+            *found = 1;
+            return entry;
+        }
+
+        /* prefer an empty entry, then the least recently used one */
+        if (entry->refcount){
+            continue;
+        }
+        if (NULL == entry->memory){
+            if (NULL == empty){
+                empty = entry;
+            }
+        }
+        else if (NULL == oldest || entry->last_used < oldest->last_used){
+            oldest = entry;
+        }
+    }
+    return (NULL != empty) ? empty : oldest;
+}
+
+void *xa_pagefile_map_page (xa_instance_t *instance, uint64_t page)
+{
+    xa_pagefile_entry_t entry = NULL;
+    uint64_t offset = page << instance->page_shift;
+    int found = 0;
+
+    if (NULL == instance->pagefile){
+        return NULL;
+    }
+    if (offset >= instance->pagefile_size ||
+        instance->page_size > instance->pagefile_size - offset){
+        fprintf(stderr, "ERROR: page 0x%llx is beyond the pagefile\n",
+            (unsigned long long) page);
+        return NULL;
+    }
+
+    if (NULL == instance->pagefile_cache){
+        instance->pagefile_cache = calloc(
+            XA_PAGEFILE_CACHE_SIZE, sizeof(struct xa_pagefile_entry));
+        if (NULL == instance->pagefile_cache){
+            return NULL;
+        }
+    }
+
+    entry = xa_pagefile_find(instance, page, &found);
+    if (NULL == entry){
+        fprintf(stderr, "ERROR: every cached pagefile page is in use\n");
+        return NULL;
+    }
+    if (!found){
+        if (NULL == entry->memory){
+            entry->memory = malloc(instance->page_size);
+            if (NULL == entry->memory){
+                return NULL;
+            }
+        }
+        if (pread(fileno(instance->pagefile), entry->memory,
+                  instance->page_size, (off_t) offset) !=
+                instance->page_size){
+            fprintf(stderr, "ERROR: failed to read pagefile page 0x%llx\n",
+                (unsigned long long) page);
+            free(entry->memory);
+            entry->memory = NULL;
+            return NULL;
+        }
+        entry->page = page;
+        xa_dbprint("--Pagefile: read page 0x%llx\n", page);
+    }
+
+    entry->refcount++;
+    entry->last_used = ++instance->pagefile_clock;
+    return entry->memory;
+}
+
+int xa_release_pagefile_page (xa_instance_t *instance, void *memory)
+{
+    uint32_t i = 0;
+
+    if (NULL == instance->pagefile_cache){
+        return 0;
+    }
+    for (i = 0; i < XA_PAGEFILE_CACHE_SIZE; ++i){
+        xa_pagefile_entry_t entry = &instance->pagefile_cache[i];
+        if (entry->memory == memory){
+            if (entry->refcount > 0){
+                entry->refcount--;
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void xa_destroy_pagefile (xa_instance_t *instance)
+{
+    uint32_t i = 0;
+
+    if (NULL != instance->pagefile_cache){
+        for (i = 0; i < XA_PAGEFILE_CACHE_SIZE; ++i){
+            free(instance->pagefile_cache[i].memory);
+        }
+        free(instance->pagefile_cache);
+    }
+    if (NULL != instance->pagefile){
+        fclose(instance->pagefile);
+    }
+    instance->pagefile = NULL;
+    instance->pagefile_size = 0;
+    instance->pagefile_cache = NULL;
+    instance->pagefile_clock = 0;
+}
@@ -53,6 +53,11 @@
 /* other globals */
 #define MAX_ROW_LENGTH 200
 
+/* file mode keeps the image mapped in windows of this size on hosts
+   where the whole image may not fit in the address space */
+#define XA_FILE_WINDOW_SHIFT 26
+#define XA_FILE_MAX_WINDOWS 16
+
 /* internal error types */
 #define XA_ENONE 0
 #define XA_ECRITICAL 1
@@ -85,7 +90,21 @@ void xa_dbprint(char *format, ...);
  * Definitions to support the LRU cache
  */
 #define XA_CACHE_SIZE 25
+#define XA_TLB_SIZE 256
+#define XA_TLB_WAYS 4
+#define XA_PDE_CACHE_SIZE 1024
+#define XA_CACHE_BUCKETS 256
 #define XA_PID_CACHE_SIZE 5
+#define XA_PID_CACHE_BUCKETS 64
+#define XA_PAGE_CACHE_SIZE 64
+#define XA_PAGE_CACHE_BUCKETS 256
+#define XA_PAGEFILE_CACHE_SIZE 32
+#define XA_PT_WATCH_SIZE 4096
+#define XA_PT_WATCH_WAYS 4
+#define XA_NEG_CACHE_SIZE 256
+#define XA_NEG_CACHE_LIFETIME 4096
+#define XA_PT_WATCH_SHIFT 12
+#define XA_PT_WATCH_FAILED 0xffffffff
 
 /**
  * Check if a symbol_name is in the LRU cache.
@@ -98,20 +117,134 @@ void xa_dbprint(char *format, ...);
 int xa_check_cache_sym (xa_instance_t *instance,
                         char *symbol_name,
                         int pid,
-                        uint32_t *mach_address);
+                        uint64_t *mach_address);
 
 /**
- * Check if a virt_address is in the LRU cache.
- * 
+ * Looks up a virtual address in the software TLB.  The TLB is set
+ * associative, keyed by the pid (the address space) and the virtual
+ * page, and holds both small and large page translations.
+ *
  * @param[in] instance libxa instance
  * @param[in] virt_address Virtual address in space of guest process.
- * @param[in] pid Id of the process.
- * @param[out] mach_address Machine address of the symbol.
+ * @param[in] pid Id of the process, or 0 for the kernel.
+ * @param[out] mach_address Machine address for virt_address.
+ * @return 1 on a hit, 0 on a miss
+ */
+int xa_check_tlb (xa_instance_t *instance,
+                  xa_addr_t virt_address,
+                  int pid,
+                  uint64_t *mach_address);
+
+/**
+ * Adds a translation to the software TLB, replacing the least recently
+ * used entry in its set.
+ *
+ * @param[in] instance libxa instance
+ * @param[in] virt_address Virtual address in space of guest process.
+ * @param[in] pid Id of the process, or 0 for the kernel.
+ * @param[in] mach_address Machine address for virt_address.
+ * @param[in] page_shift Size of the page that maps virt_address
+ * @param[in] tags XA_PT_LEVELS tags from xa_watch_page for the paging
+ *            pages used by the translation (unused ones are 0), or NULL
+ * @return 1 if the translation was added, 0 otherwise
+ */
+int xa_update_tlb (xa_instance_t *instance,
+                   xa_addr_t virt_address,
+                   int pid,
+                   uint64_t mach_address,
+                   uint32_t page_shift,
+                   const uint32_t *tags);
+
+/**
+ * Starts tracking changes to a page of the paging structures, see
+ * xa_invalidate.  The tag that is returned stays valid until the page
+ * is found to have changed, so cached values that were read from the
+ * page keep the tag and are dropped once it is no longer valid.
+ *
+ * @param[in] instance libxa instance
+ * @param[in] frame Machine frame number of the page
+ * @return Tag for the page, or XA_PT_WATCH_FAILED (which is never
+ *         valid) if it can't be tracked
+ */
+uint32_t xa_watch_page (xa_instance_t *instance, uint64_t frame);
+
+/**
+ * Checks a tag from xa_watch_page.
+ *
+ * @param[in] instance libxa instance
+ * @param[in] tag Tag to check, where 0 is always valid and
+ *            XA_PT_WATCH_FAILED never is
+ * @return 1 if the page has not changed since the tag was made, else 0
+ */
+int xa_watch_valid (xa_instance_t *instance, uint32_t tag);
+
+/**
+ * Frees the pages watched by xa_watch_page.  This must come after the
+ * caches holding tags are destroyed.
+ *
+ * @param[in] instance libxa instance
+ */
+void xa_destroy_pt_watch (xa_instance_t *instance);
+
+/**
+ * Releases the software TLB and the paging-structure cache.
+ *
+ * @param[in] instance libxa instance
+ * @return 0 for success.
+ */
+int xa_destroy_tlb (xa_instance_t *instance);
+
+/**
+ * Looks up a page directory pointer or page directory entry in the
+ * paging-structure cache, which is keyed by the machine address of the
+ * entry.  Walks that stay within one large page region can then skip
+ * mapping the upper level tables.
+ *
+ * @param[in] instance libxa instance
+ * @param[in] entry_address Machine address of the paging entry
+ * @param[out] value Contents of the entry
+ * @return 1 on a hit, 0 on a miss
  */
-int xa_check_cache_virt (xa_instance_t *instance,
-                         uint32_t virt_address,
-                         int pid,
-                         uint32_t *mach_address);
+int xa_check_pde_cache (
+    xa_instance_t *instance, uint64_t entry_address, uint64_t *value);
+
+/**
+ * Adds a present paging entry to the paging-structure cache.
+ *
+ * @param[in] instance libxa instance
+ * @param[in] entry_address Machine address of the paging entry
+ * @param[in] value Contents of the entry
+ */
+void xa_update_pde_cache (
+    xa_instance_t *instance, uint64_t entry_address, uint64_t value);
+
+/**
+ * Checks if a virtual address was recently found to be unmapped, in a
+ * region of any of the sizes that a missing paging entry can leave.
+ * Entries last for XA_NEG_CACHE_LIFETIME checks, and are dropped
+ * sooner if a page table they came from changes (see xa_invalidate).
+ *
+ * @param[in] instance libxa instance
+ * @param[in] virt_address Virtual address in space of guest process.
+ * @param[in] pid Id of the process, or 0 for the kernel.
+ * @return 1 if the address is known to be unmapped, else 0
+ */
+int xa_check_neg_cache (
+    xa_instance_t *instance, xa_addr_t virt_address, int pid);
+
+/**
+ * Remembers that a region of virtual memory is unmapped.
+ *
+ * @param[in] instance libxa instance
+ * @param[in] virt_address Virtual address in space of guest process.
+ * @param[in] pid Id of the process, or 0 for the kernel.
+ * @param[in] page_shift Size of the unmapped region around virt_address
+ * @param[in] tags XA_PT_LEVELS tags from xa_watch_page for the paging
+ *            pages read by the failed walk, or NULL
+ */
+void xa_update_neg_cache (
+    xa_instance_t *instance, xa_addr_t virt_address, int pid,
+    uint32_t page_shift, const uint32_t *tags);
 
 /**
  * Updates cache of guest symbols. Every symbol name has an 
@@ -126,9 +259,9 @@ int xa_check_cache_virt (xa_instance_t *instance,
  */
 int xa_update_cache (xa_instance_t *instance,
                      char *symbol_name,
-                     uint32_t virt_address,
+                     xa_addr_t virt_address,
                      int pid,
-                     uint32_t mach_address);
+                     uint64_t mach_address);
 
 /**
  * Releases the cache.
@@ -138,10 +271,45 @@ int xa_update_cache (xa_instance_t *instance,
  */
 int xa_destroy_cache (xa_instance_t *instance);
 
-int xa_check_pid_cache (xa_instance_t *instance, int pid, uint32_t *pgd);
-int xa_update_pid_cache (xa_instance_t *instance, int pid, uint32_t pgd);
+int xa_check_pid_cache (xa_instance_t *instance, int pid, uint64_t *pgd);
+int xa_update_pid_cache (xa_instance_t *instance, int pid, uint64_t pgd);
 int xa_destroy_pid_cache (xa_instance_t *instance);
 
+/**
+ * Looks for a mapping of the given frame in the page cache.  On a hit
+ * the page's reference count is incremented, so it must later be
+ * released with xa_munmap.
+ *
+ * @param[in] instance libxa instance
+ * @param[in] frame_num Frame number, as passed to xa_map_page
+ * @return Mapped memory or NULL if the frame is not cached
+ */
+void *xa_check_page_cache (xa_instance_t *instance, unsigned long frame_num);
+
+/**
+ * Adds a newly mapped read-only page to the page cache with a reference
+ * count of one.  When the cache is full, the least recently used page
+ * that is not in use is unmapped to make room.
+ *
+ * @param[in] instance libxa instance
+ * @param[in] frame_num Frame number, as passed to xa_map_page
+ * @param[in] memory Mapping of that frame
+ * @return 1 if the page was cached, 0 if the caller still owns it
+ */
+int xa_update_page_cache (
+    xa_instance_t *instance, unsigned long frame_num, void *memory);
+
+/**
+ * Drops a reference to a page in the page cache.  The page stays
+ * mapped until it is evicted.
+ *
+ * @param[in] instance libxa instance
+ * @param[in] memory Mapped memory returned by xa_map_page
+ * @return 1 if the page was cached, 0 if it must be unmapped by the caller
+ */
+int xa_release_page_cache (xa_instance_t *instance, void *memory);
+int xa_destroy_page_cache (xa_instance_t *instance);
+
 /*--------------------------------------------
  * Print util functions from xa_pretty_print.c
  */
@@ -165,6 +333,240 @@ void print_hex (unsigned char *data, int length);
 void print_dominfo (xc_dominfo_t info);
 #endif /* ENABLE_XEN */
 
+/*-------------------------------------------------------
+ * Memory backends from xa_xen.c, xa_file.c, xa_mock.c and xa_snapshot.c
+ */
+
+/* register numbers for the get_vcpureg backend operation */
+#define XA_REG_CR0 0
+#define XA_REG_CR3 3
+#define XA_REG_CR4 4
+
+/**
+ * Table of operations that provide access to the memory of a target.
+ * One table is selected when the instance is initialized, based on the
+ * mode, and all memory accesses go through it.  Operations that a
+ * backend does not support may be left NULL where noted.
+ */
+struct xa_backend{
+    /** name of the backend, for debug output */
+    char *name;
+
+    /** finds the memory size and prepares the backend for access */
+    int (*init) (xa_instance_t *instance);
+
+    /** releases everything held by the backend */
+    int (*destroy) (xa_instance_t *instance);
+
+    /** returns the size of the target's memory, in bytes */
+    uint64_t (*get_size) (xa_instance_t *instance);
+
+    /** converts a page frame number to a machine frame number, or -1 */
+    unsigned long (*pfn_to_mfn) (xa_instance_t *instance, unsigned long pfn);
+
+    /** maps one machine frame; released with unmap */
+    void *(*map_page) (
+        xa_instance_t *instance, int prot, unsigned long frame_num);
+
+    /** maps several machine frames into one contiguous range */
+    void *(*map_pages) (
+        xa_instance_t *instance, int prot,
+        const unsigned long *frames, uint32_t num);
+
+    /** returns a read-only page from a mapping that the backend keeps
+        for its whole life, or NULL (the operation may be NULL) */
+    void *(*direct_page) (xa_instance_t *instance, unsigned long frame_num);
+
+    /** releases memory returned by map_page or map_pages */
+    int (*unmap) (xa_instance_t *instance, void *memory, uint32_t length);
+
+    /** copies physical memory into a buffer */
+    int (*read) (
+        xa_instance_t *instance, uint64_t paddr, void *buf, uint32_t count);
+
+    /** returns the first address at or after paddr that may hold data,
+        skipping holes in sparse images (may be NULL if there are none) */
+    uint64_t (*next_data) (xa_instance_t *instance, uint64_t paddr);
+
+    /** pauses and resumes the target (may be NULL if it never runs) */
+    int (*pause) (xa_instance_t *instance);
+    int (*resume) (xa_instance_t *instance);
+
+    /** reads a control register from a vcpu (may be NULL) */
+    int (*get_vcpureg) (
+        xa_instance_t *instance, int reg, int vcpu, uint64_t *value);
+};
+
+#ifdef ENABLE_XEN
+extern struct xa_backend xa_xen_backend;
+#endif /* ENABLE_XEN */
+extern struct xa_backend xa_file_backend;
+extern struct xa_backend xa_mock_backend;
+extern struct xa_backend xa_snapshot_backend;
+
+/*-------------------------------------------------
+ * Compressed memory snapshots from xa_snapshot.c
+ */
+
+/* identifies a snapshot file, see xa_write_snapshot */
+#define XA_SNAPSHOT_MAGIC "XASNAP01"
+#define XA_SNAPSHOT_VERSION 1
+
+/* memory is compressed in chunks of this size, each on its own */
+#define XA_SNAPSHOT_CHUNK_SHIFT 16
+
+/* number of decompressed chunks kept by the snapshot backend */
+#define XA_SNAPSHOT_CACHE_CHUNKS 8
+
+/* flags for the chunk index entries */
+#define XA_SNAPSHOT_ZERO 1  /* chunk is all zeros and has no data */
+#define XA_SNAPSHOT_RAW 2   /* chunk data is stored uncompressed */
+
+/* start of a snapshot file, which is followed by the chunk index and
+   then the chunk data.  fields are in the byte order of the writer. */
+struct xa_snapshot_header{
+    char magic[8];          /* XA_SNAPSHOT_MAGIC, without the nul */
+    uint32_t version;       /* XA_SNAPSHOT_VERSION */
+    uint32_t page_shift;    /* page size of the memory that was saved */
+    uint32_t chunk_shift;   /* log2 of the size of each chunk */
+    uint32_t nr_chunks;     /* number of entries in the index */
+    uint64_t size;          /* size of the memory that was saved */
+};
+
+/* one entry in the chunk index */
+struct xa_snapshot_chunk{
+    uint64_t offset;        /* file offset of the chunk data */
+    uint32_t length;        /* bytes of chunk data in the file */
+    uint32_t flags;         /* XA_SNAPSHOT_ZERO, XA_SNAPSHOT_RAW or 0 */
+};
+
+/* one decompressed chunk held by the snapshot backend */
+struct xa_snapshot_slot{
+    uint32_t chunk;         /* chunk number, or 0xffffffff if unused */
+    uint32_t last_used;     /* clock value at the last use */
+    unsigned char *data;    /* the decompressed chunk */
+};
+
+/* state of the snapshot backend, found in instance->m.file.snapshot */
+struct xa_snapshot{
+    struct xa_snapshot_header header;
+    struct xa_snapshot_chunk *index;
+    unsigned char *compressed;  /* buffer for reading compressed chunks */
+    struct xa_snapshot_slot cache[XA_SNAPSHOT_CACHE_CHUNKS];
+    uint32_t clock;
+};
+
+/**
+ * Checks if a file holds a compressed snapshot rather than a raw
+ * memory image.
+ *
+ * @param[in] fhandle Open handle to the file
+ * @return nonzero if the file is a snapshot
+ */
+int xa_snapshot_probe (FILE *fhandle);
+
+/*-------------------------------------------------
+ * Persistent symbol cache from xa_symcache.c
+ */
+
+/* one symbol address, or kernel layout value when the name starts
+   with '@' */
+struct xa_symcache_entry{
+    char *name;
+    uint64_t value;
+};
+
+/* symbols for one kernel, found in instance->symcache */
+struct xa_symcache{
+    char *path;         /* file the symbols are loaded from and saved to */
+    uint64_t key;       /* identity of the kernel, or 0 if not known yet */
+    struct xa_symcache_entry *entries;  /* sorted by name */
+    uint32_t count;
+    uint32_t space;
+    int dirty;          /* nonzero if the file needs to be written */
+};
+
+/**
+ * Sets the file for the persistent symbol cache.  Nothing is read until
+ * xa_symcache_load, since the kernel can't be identified yet.
+ *
+ * @param[in] instance libxa instance
+ * @param[in] filename Path of the cache file, which need not exist
+ * @return XA_SUCCESS or XA_FAILURE
+ */
+int xa_symcache_open (xa_instance_t *instance, char *filename);
+
+/**
+ * Loads the persistent symbol cache if it was saved for this kernel.
+ * For Windows, a cached ntoskrnl base is tried first when the config
+ * file doesn't give one.
+ *
+ * @param[in] instance libxa instance
+ */
+void xa_symcache_load (xa_instance_t *instance);
+
+/**
+ * Looks up a symbol address or layout value in the persistent cache.
+ *
+ * @param[in] instance libxa instance
+ * @param[in] name Symbol name, or '@' and the name of a layout value
+ * @param[out] value The cached value
+ * @return 1 if found, else 0
+ */
+int xa_symcache_lookup (xa_instance_t *instance, char *name, uint64_t *value);
+
+/**
+ * Adds a symbol address or layout value to the persistent cache.  This
+ * does nothing if there is no cache file.
+ *
+ * @param[in] instance libxa instance
+ * @param[in] name Symbol name, or '@' and the name of a layout value
+ * @param[in] value Value to remember
+ */
+void xa_symcache_add (xa_instance_t *instance, char *name, uint64_t value);
+
+/**
+ * Saves the persistent symbol cache if anything was added, then frees
+ * it.  Windows needs guest memory to identify the kernel, so this must
+ * come before the backend is destroyed.
+ *
+ * @param[in] instance libxa instance
+ */
+void xa_destroy_symcache (xa_instance_t *instance);
+
+/*-------------------------------------------------
+ * Physical to virtual reverse map from xa_rmap.c
+ */
+
+/* frees the reverse map, see xa_reverse_lookup */
+void xa_destroy_reverse_map (xa_instance_t *instance);
+
+/*-------------------------------------------------
+ * Windows pagefile image from xa_pagefile.c
+ */
+
+/**
+ * Gets a page from the pagefile image, see xa_set_pagefile.  The page
+ * is released with xa_munmap.
+ *
+ * @param[in] instance libxa instance
+ * @param[in] page Page number within the pagefile
+ * @return Copy of the page, or NULL on error
+ */
+void *xa_pagefile_map_page (xa_instance_t *instance, uint64_t page);
+
+/**
+ * Releases a page returned by xa_pagefile_map_page.
+ *
+ * @param[in] instance libxa instance
+ * @param[in] memory Memory that may have come from the pagefile
+ * @return 1 if memory was a pagefile page, else 0
+ */
+int xa_release_pagefile_page (xa_instance_t *instance, void *memory);
+
+/* closes the pagefile image and frees its cached pages */
+void xa_destroy_pagefile (xa_instance_t *instance);
+
 /*-----------------------------------------
  * Memory access functions from xa_memory.c
  */
@@ -172,7 +574,7 @@ void print_dominfo (xc_dominfo_t info);
 /**
  * Memory maps one page from domU to a local address range.  The
  * memory to be mapped is specified with the machine frame number.
- * This memory must be unmapped manually with munmap.
+ * This memory must be released manually with xa_munmap.
  *
  * @param[in] instance libxa instance
  * @param[in] prot Desired memory protection (see 'man mmap' for values)
@@ -184,7 +586,7 @@ void *xa_mmap_mfn (xa_instance_t *instance, int prot, unsigned long mfn);
 /**
  * Memory maps one page from domU to a local address range.  The
  * memory to be mapped is specified with the page frame number.
- * This memory must be unmapped manually with munmap.
+ * This memory must be released manually with xa_munmap.
  *
  * @param[in] instance libxa instance
  * @param[in] prot Desired memory protection (see 'man mmap' for values)
@@ -193,6 +595,47 @@ void *xa_mmap_mfn (xa_instance_t *instance, int prot, unsigned long mfn);
  */
 void *xa_mmap_pfn (xa_instance_t *instance, int prot, unsigned long pfn);
 
+/**
+ * Converts a page frame number to a machine frame number using the
+ * live mapping tables of a Xen PV domain.  For HVM domains the frame
+ * number is returned unchanged.
+ *
+ * @param[in] instance libxa instance
+ * @param[in] pfn Page frame number
+ * @return Machine frame number, or -1 on error
+ */
+unsigned long helper_pfn_to_mfn (xa_instance_t *instance, unsigned long pfn);
+
+/**
+ * Skips over holes in sparse memory images, which read as zeros.  Code
+ * that scans all of physical memory uses this to avoid looking at pages
+ * that can't hold anything.
+ *
+ * @param[in] instance libxa instance
+ * @param[in] paddr Page aligned physical address to start from
+ * @return Start of the first page at or after paddr that may hold data,
+ *         or the memory size if there is none
+ */
+uint64_t xa_next_data_page (xa_instance_t *instance, uint64_t paddr);
+
+/**
+ * Gets the page directory that is currently loaded on the target.  When
+ * the backend has no live registers, the kernel page directory is used.
+ *
+ * @param[in] instance libxa instance
+ * @param[out] cr3 Value of the CR3 register
+ * @return XA_SUCCESS or XA_FAILURE
+ */
+uint32_t xa_current_cr3 (xa_instance_t *instance, uint64_t *cr3);
+
+/**
+ * Selects the page walk used by xa_pagetable_lookup.  This must be
+ * called whenever the pae, pse or ia32e flags of the instance change.
+ *
+ * @param[in] instance libxa instance
+ */
+void xa_set_paging_mode (xa_instance_t *instance);
+
 /**
  * Covert virtual address to machine address via page table lookup.
  *
@@ -202,23 +645,145 @@ void *xa_mmap_pfn (xa_instance_t *instance, int prot, unsigned long pfn);
  *
  * @return Machine address resulting from page table lookup.
  */
-uint32_t xa_pagetable_lookup (
-            xa_instance_t *instance, uint32_t pgd,
-            uint32_t virt_address);
+uint64_t xa_pagetable_lookup (
+            xa_instance_t *instance, uint64_t pgd,
+            xa_addr_t virt_address);
+
+/**
+ * Page walk state that is carried between lookups of nearby addresses,
+ * so that a walk over a range of pages only reads each page directory
+ * entry once.
+ */
+typedef struct xa_walk_state{
+    uint64_t cr3;       /**< page directory used for the walk */
+    int pml4e_valid;    /**< nonzero if pml4e holds a cached entry */
+    xa_addr_t pml4e_key; /**< vaddr >> 39 for the cached pml4e */
+    uint64_t pml4e;     /**< cached PML4 entry (IA-32e) */
+    int pdpe_valid;     /**< nonzero if pdpe holds a cached entry */
+    xa_addr_t pdpe_key; /**< vaddr >> 30 for the cached pdpe */
+    uint64_t pdpe;      /**< cached page directory pointer entry */
+    int pde_valid;      /**< nonzero if pde holds a cached entry */
+    xa_addr_t pde_key;  /**< vaddr >> 21 (PAE, IA-32e) or 22 for the pde */
+    uint64_t pde;       /**< cached page directory entry, or the pdpe
+                             when it maps a 1GB page */
+    uint32_t pde_shift; /**< page shift if pde maps a large page, else 12 */
+    uint64_t pte;       /**< page table entry read by the last lookup */
+} xa_walk_state_t;
+
+/**
+ * Prepares a walk state for lookups in the given page directory.
+ *
+ * @param[out] walk Walk state to initialize.
+ * @param[in] cr3 Page directory to use for the lookups.
+ */
+void xa_walk_init (xa_walk_state_t *walk, uint64_t cr3);
+
+/**
+ * Covert virtual address to machine address via page table lookup,
+ * reusing the directory entries cached in @a walk when possible.
+ *
+ * @param[in] instance Handle to xenaccess instance.
+ * @param[in,out] walk Walk state from xa_walk_init.
+ * @param[in] virt_address Virtual address to convert.
+ *
+ * @return Machine address, or zero if the address is not mapped.
+ */
+uint64_t xa_walk_lookup (
+            xa_instance_t *instance, xa_walk_state_t *walk,
+            xa_addr_t virt_address);
+
+/**
+ * Gets the size of the page that mapped the address given to the last
+ * successful xa_walk_lookup with this walk state.
+ *
+ * @param[in] instance Handle to xenaccess instance.
+ * @param[in] walk Walk state used for the lookup.
+ *
+ * @return log2 of the page size (12 for 4KB pages, up to 30 for 1GB).
+ */
+uint32_t xa_walk_page_shift (xa_instance_t *instance, xa_walk_state_t *walk);
 
 /**
- * Find the address of the page global directory for a given PID
+ * Callback for xa_for_each_process.
  *
  * @param[in] instance Handle to xenaccess instance.
- * @param[in] pid The process to lookup.
+ * @param[in] pid PID of the process.
+ * @param[in] pgd Physical address of the process's page directory.
+ * @param[in] ctx Pointer that was passed to xa_for_each_process.
  *
- * @return Address of pgd, or zero if no address could be found.
+ * @return 0 to continue, or nonzero to stop.
  */
-uint32_t xa_pid_to_pgd (xa_instance_t *instance, int pid);
+typedef int (*xa_process_cb_t) (
+        xa_instance_t *instance, int pid, uint64_t pgd, void *ctx);
+
+/**
+ * Walks the guest's process list once, calling @a cb for each process
+ * that has its own address space.  The pid cache is updated with every
+ * page directory that is found.
+ *
+ * @param[in] instance Handle to xenaccess instance.
+ * @param[in] cb Function called for each process.
+ * @param[in] ctx Pointer passed through to @a cb.
+ *
+ * @return XA_SUCCESS, or XA_FAILURE on error or if @a cb stopped the walk.
+ */
+int xa_for_each_process (
+        xa_instance_t *instance, xa_process_cb_t cb, void *ctx);
+int linux_for_each_process (
+        xa_instance_t *instance, xa_process_cb_t cb, void *ctx);
+int windows_for_each_process (
+        xa_instance_t *instance, xa_process_cb_t cb, void *ctx);
+uint64_t linux_pid_to_pgd (xa_instance_t *instance, int pid);
+uint64_t windows_pid_to_pgd (xa_instance_t *instance, int pid);
+
+/* one symbol for xa_prefetch_symbols to find */
+typedef struct xa_prefetch{
+    const char *name;
+    uint32_t address;   /* virtual address, or RVA for Windows */
+    int found;
+} xa_prefetch_t;
+
+/**
+ * Sorts a list of symbols for xa_prefetch_find, from xa_symbols.c.
+ */
+void xa_prefetch_sort (xa_prefetch_t *list, uint32_t count);
+
+/**
+ * Finds a symbol in a sorted list, or NULL if the list doesn't have it.
+ * The name need not be null terminated.  If the list has the name more
+ * than once, the first one is returned.
+ *
+ * @param[in] list Symbols sorted with xa_prefetch_sort
+ * @param[in] count Number of symbols in the list
+ * @param[in] name Name to look for
+ * @param[in] length Length of the name
+ */
+xa_prefetch_t *xa_prefetch_find (
+    xa_prefetch_t *list, uint32_t count, const char *name, size_t length);
+
+
+/* one row of the System.map, found in struct xa_sysmap */
+struct xa_sysmap_symbol{
+    uint32_t address;
+    uint32_t name;      /* offset of the name in the file */
+    uint32_t length;    /* length of the name, which isn't terminated */
+    uint32_t hash_next; /* index + 1 of the next symbol in the bucket */
+};
+
+/* a System.map file mapped into memory, in instance->sysmap_index */
+struct xa_sysmap{
+    char *data;         /* contents of the file */
+    size_t size;
+    struct xa_sysmap_symbol *symbols;   /* sorted by address */
+    uint32_t count;
+    uint32_t *buckets;  /* index + 1 of the first symbol, or 0 */
+    uint32_t bucket_mask;
+};
 
 /**
  * Gets address of a symbol in domU virtual memory. It uses System.map
- * file specified in xenaccess configuration file.
+ * file specified in xenaccess configuration file, which is indexed the
+ * first time a symbol is looked up.
  *
  * @param[in] instance Handle to xenaccess instance (see xa_init).
  * @param[in] symbol Name of the requested symbol.
@@ -227,6 +792,52 @@ uint32_t xa_pid_to_pgd (xa_instance_t *instance, int pid);
 int linux_system_map_symbol_to_address (
         xa_instance_t *instance, char *symbol, uint32_t *address);
 
+/**
+ * Finds the symbol that contains an address, which is the symbol with
+ * the highest address at or below it in the System.map file.
+ *
+ * @param[in] instance Handle to xenaccess instance (see xa_init).
+ * @param[in] address Kernel virtual address.
+ * @param[out] name Buffer for the symbol name, truncated if needed.
+ * @param[in] length Size of the name buffer.
+ * @param[out] offset Offset of the address from the symbol.
+ * @return XA_SUCCESS or XA_FAILURE
+ */
+int linux_system_map_address_to_symbol (
+        xa_instance_t *instance, uint32_t address,
+        char *name, size_t length, uint32_t *offset);
+
+/**
+ * Finds the addresses of several symbols in the System.map file, see
+ * xa_prefetch_symbols.
+ *
+ * @param[in] instance Handle to xenaccess instance (see xa_init).
+ * @param[in,out] list Symbols to find, sorted with xa_prefetch_sort.
+ * @param[in] count Number of symbols in the list.
+ * @return Number of symbols found
+ */
+uint32_t linux_system_map_prefetch (
+        xa_instance_t *instance, xa_prefetch_t *list, uint32_t count);
+
+/**
+ * Identifies the Linux kernel by its System.map file, for the persistent
+ * symbol cache.  This only stats the file, so it costs nothing when all
+ * of the symbols are found in the cache.
+ *
+ * @param[in] instance Handle to xenaccess instance.
+ * @param[out] key Hash of the device, inode, size and modification time
+ *             of the System.map file.
+ * @return XA_SUCCESS or XA_FAILURE
+ */
+int linux_system_map_identity (xa_instance_t *instance, uint64_t *key);
+
+/**
+ * Unmaps the System.map file and frees its index.
+ *
+ * @param[in] instance Handle to xenaccess instance.
+ */
+void linux_destroy_system_map (xa_instance_t *instance);
+
 /**
  * Gets a memory page where @a symbol is located and sets @a offset
  * of the symbol. The mapping is cached internally. 
@@ -241,6 +852,16 @@ int linux_system_map_symbol_to_address (
 void *linux_access_kernel_symbol (
         xa_instance_t *instance, char *symbol, uint32_t *offset, int prot);
 
+/**
+ * Finds the end of the Linux lowmem map, where virtual addresses are
+ * the physical address plus page_offset.
+ *
+ * @param[in] instance Handle to xenaccess instance.
+ *
+ * @return First virtual address past the map, or zero on error.
+ */
+uint32_t linux_lowmem_end (xa_instance_t *instance);
+
 /**
  * Gets name of the kernel for given \a id.
  *
@@ -284,8 +905,10 @@ void *windows_access_kernel_symbol (
 int windows_init (xa_instance_t *instance);
 int linux_init (xa_instance_t *instance);
 int get_symbol_row (FILE *f, char *row, char *symbol, int position);
-void *xa_map_file_range (xa_instance_t *instance, int prot, unsigned long pfn);
 void *xa_map_page (xa_instance_t *instance, int prot, unsigned long frame_num);
+void *xa_map_pages (
+        xa_instance_t *instance, int prot,
+        const unsigned long *frames, uint32_t num);
 uint32_t windows_find_eprocess (xa_instance_t *instance, char *name);
 uint32_t xa_find_kernel_pd (xa_instance_t *instance);
 int xa_report_error (xa_instance_t *instance, int error, int error_type);
@@ -293,8 +916,31 @@ uint32_t xa_get_domain_id (char *name);
 char *linux_predict_sysmap_name (uint32_t id);
 
 int windows_export_to_rva (xa_instance_t *, char *, uint32_t *);
+
+/**
+ * Finds the RVAs of several exports in one pass over the export names
+ * of ntoskrnl, see xa_prefetch_symbols.
+ *
+ * @param[in] instance Handle to xenaccess instance.
+ * @param[in,out] list Symbols to find, sorted with xa_prefetch_sort.
+ * @param[in] count Number of symbols in the list.
+ * @return Number of symbols found
+ */
+uint32_t windows_export_prefetch (
+        xa_instance_t *instance, xa_prefetch_t *list, uint32_t count);
 int valid_ntoskrnl_start (xa_instance_t *instance, uint32_t addr);
 
+/**
+ * Identifies a Windows kernel image by the timestamp and checksum in its
+ * PE header, for the persistent symbol cache.
+ *
+ * @param[in] instance Handle to xenaccess instance.
+ * @param[in] base Physical address of the image.
+ * @param[out] key Timestamp in the upper 32 bits, checksum in the lower.
+ * @return XA_SUCCESS or XA_FAILURE if there is no PE image at @a base
+ */
+int windows_pe_identity (xa_instance_t *instance, uint32_t base, uint64_t *key);
+
 
 /** Duplicate function from xc_util that should remain
  *  here until Xen 3.1.2 becomes widely distributed.
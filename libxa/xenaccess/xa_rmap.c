@@ -0,0 +1,263 @@
+/*
+ * The libxa library provides access to resources in domU machines.
+ *
+ * Copyright (C) 2005 - 2008  Bryan D. Payne (bryan@thepaynes.cc)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * --------------------
+ * This file contains the physical to virtual reverse map.  The map is
+ * an array with one entry for each virtual page that maps a physical
+ * frame, sorted by frame so that lookups are a binary search.
+ *
+ * File: xa_rmap.c
+ *
+ * Author(s): Bryan D. Payne (bryan@thepaynes.cc)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xenaccess.h"
+#include "xa_private.h"
+
+/* the map is kept in 4KB frames, even for large pages */
+#define XA_RMAP_SHIFT 12
+#define XA_RMAP_INITIAL 1024
+
+/* state for adding the mappings of one address space to the map */
+struct xa_rmap_build{
+    int pid;      /* owner of the mappings being added */
+    int kernel;   /* nonzero to add kernel space, else user space */
+    int failed;   /* set if the map couldn't grow */
+};
+
+static int xa_rmap_compare (const void *a, const void *b)
+{
+    const xa_rmap_entry_t *x = a;
+    const xa_rmap_entry_t *y = b;
+
+    if (x->frame != y->frame){
+        return x->frame < y->frame ? -1 : 1;
+    }
+    if (x->pid != y->pid){
+        return x->pid < y->pid ? -1 : 1;
+    }
+    if (x->vaddr != y->vaddr){
+        return x->vaddr < y->vaddr ? -1 : 1;
+    }
+    return 0;
+}
+
+static int xa_rmap_add (
+        xa_instance_t *instance, uint64_t frame, xa_addr_t vaddr, int pid)
+{
+    xa_rmap_entry_t *entry = NULL;
+
+    if (instance->rmap_count == instance->rmap_space){
+        uint32_t space = instance->rmap_space * 2;
+        xa_rmap_entry_t *rmap =
+            realloc(instance->rmap, space * sizeof(xa_rmap_entry_t));
+        if (NULL == rmap){
+            fprintf(stderr, "ERROR: failed to grow the reverse map\n");
+            return XA_FAILURE;
+        }
+        instance->rmap = rmap;
+        instance->rmap_space = space;
+    }
+
+    entry = &instance->rmap[instance->rmap_count++];
+    entry->frame = frame;
+    entry->vaddr = vaddr;
+    entry->pid = pid;
+    return XA_SUCCESS;
+}
+
+/* kernel space is the canonical upper half in long mode, since
+   page_offset only describes a 32-bit split */
+static int xa_rmap_is_kernel (xa_instance_t *instance, xa_addr_t vaddr)
+{
+    if (instance->ia32e){
+        return vaddr >= 0xFFFF800000000000ULL;
+    }
+    return vaddr >= instance->page_offset;
+}
+
+/* xa_mapping_cb_t that adds one page at a time from each run */
+static int xa_rmap_mapping (
+        xa_instance_t *instance, xa_addr_t virt_address,
+        uint64_t phys_address, uint64_t length, void *ctx)
+{
+    struct xa_rmap_build *build = ctx;
+    uint64_t offset = 0;
+
+    for (offset = 0; offset < length; offset += 1 << XA_RMAP_SHIFT){
+        xa_addr_t vaddr = virt_address + offset;
+
+        /* the kernel half of every process is added once, as pid 0 */
+        if (xa_rmap_is_kernel(instance, vaddr) != build->kernel){
+            continue;
+        }
+        if (xa_rmap_add(instance, (phys_address + offset) >> XA_RMAP_SHIFT,
+                        vaddr, build->pid) == XA_FAILURE){
+            build->failed = 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int xa_rmap_add_kernel (xa_instance_t *instance)
+{
+    struct xa_rmap_build build = { 0, 1, 0 };
+    uint64_t cr3 = 0;
+
+    /* the same root that xa_translate_kv2p walks; on Xen PV domains
+       kpgd isn't a kernel virtual address */
+    if (xa_current_cr3(instance, &cr3) == XA_FAILURE){
+        return XA_FAILURE;
+    }
+    xa_walk_address_space(instance, cr3, xa_rmap_mapping, &build);
+    return build.failed ? XA_FAILURE : XA_SUCCESS;
+}
+
+/* xa_process_cb_t that adds the user space of a process */
+static int xa_rmap_process (
+        xa_instance_t *instance, int pid, uint64_t pgd, void *ctx)
+{
+    struct xa_rmap_build *build = ctx;
+
+    build->pid = pid;
+    build->kernel = 0;
+    xa_walk_address_space(instance, pgd, xa_rmap_mapping, build);
+    return build->failed;
+}
+
+static int xa_build_reverse_map (xa_instance_t *instance)
+{
+    struct xa_rmap_build build = { 0, 0, 0 };
+
+    xa_destroy_reverse_map(instance);
+    instance->rmap = malloc(XA_RMAP_INITIAL * sizeof(xa_rmap_entry_t));
+    if (NULL == instance->rmap){
+        fprintf(stderr, "ERROR: failed to allocate the reverse map\n");
+        return XA_FAILURE;
+    }
+    instance->rmap_space = XA_RMAP_INITIAL;
+
+    if (xa_rmap_add_kernel(instance) == XA_FAILURE){
+        goto error_exit;
+    }
+
+    /* a missing process list still leaves the kernel mappings */
+    if (xa_for_each_process(instance, xa_rmap_process, &build) == XA_FAILURE){
+        xa_dbprint("--reverse map has no user mappings\n");
+    }
+    if (build.failed){
+        goto error_exit;
+    }
+
+    qsort(instance->rmap, instance->rmap_count,
+          sizeof(xa_rmap_entry_t), xa_rmap_compare);
+    xa_dbprint("--built reverse map with %u entries\n", instance->rmap_count);
+    return XA_SUCCESS;
+
+error_exit:
+    xa_destroy_reverse_map(instance);
+    return XA_FAILURE;
+}
+
+int xa_refresh_reverse_map (xa_instance_t *instance, int pid)
+{
+    struct xa_rmap_build build = { 0, 0, 0 };
+    uint64_t pgd = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    int ret = XA_SUCCESS;
+
+    if (pid < 0 || NULL == instance->rmap){
+        return xa_build_reverse_map(instance);
+    }
+
+    /* drop the old entries for this address space */
+    for (i = 0; i < instance->rmap_count; ++i){
+        if (instance->rmap[i].pid != pid){
+            instance->rmap[j++] = instance->rmap[i];
+        }
+    }
+    instance->rmap_count = j;
+
+    if (!pid){
+        ret = xa_rmap_add_kernel(instance);
+    }
+    else if ((pgd = xa_pid_to_pgd(instance, pid))){
+        ret = xa_rmap_process(instance, pid, pgd, &build) ?
+            XA_FAILURE : XA_SUCCESS;
+    }
+    else{
+        ret = XA_FAILURE;
+    }
+
+    /* the new entries were added unsorted at the end */
+    qsort(instance->rmap, instance->rmap_count,
+          sizeof(xa_rmap_entry_t), xa_rmap_compare);
+    return ret;
+}
+
+uint32_t xa_reverse_lookup (
+        xa_instance_t *instance, uint64_t phys_address,
+        xa_rmap_entry_t *results, uint32_t max)
+{
+    uint64_t frame = phys_address >> XA_RMAP_SHIFT;
+    uint32_t offset = phys_address & ((1 << XA_RMAP_SHIFT) - 1);
+    uint32_t low = 0;
+    uint32_t high = 0;
+    uint32_t found = 0;
+
+    if (NULL == instance->rmap &&
+        xa_build_reverse_map(instance) == XA_FAILURE){
+        return 0;
+    }
+
+    /* find the first entry for the frame */
+    high = instance->rmap_count;
+    while (low < high){
+        uint32_t mid = low + (high - low) / 2;
+        if (instance->rmap[mid].frame < frame){
+            low = mid + 1;
+        }
+        else{
+            high = mid;
+        }
+    }
+
+    for (; low < instance->rmap_count &&
+           instance->rmap[low].frame == frame; ++low, ++found){
+        if (found < max){
+            results[found] = instance->rmap[low];
+            results[found].vaddr += offset;
+        }
+    }
+    return found;
+}
+
+void xa_destroy_reverse_map (xa_instance_t *instance)
+{
+    if (instance->rmap) free(instance->rmap);
+    instance->rmap = NULL;
+    instance->rmap_count = 0;
+    instance->rmap_space = 0;
+}
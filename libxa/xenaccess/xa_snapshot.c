@@ -0,0 +1,458 @@
+/*
+ * The libxa library provides access to resources in domU machines.
+ *
+ * Copyright (C) 2005 - 2008  Bryan D. Payne (bryan@thepaynes.cc)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * --------------------
+ * This file contains the writer and the memory backend for compressed
+ * snapshots.  A snapshot is a header, an index with one entry per chunk
+ * of physical memory, and then the chunks themselves, each compressed
+ * separately with zlib.  Reads only touch the chunks that they need.
+ *
+ * File: xa_snapshot.c
+ *
+ * Author(s): Bryan D. Payne (bryan@thepaynes.cc)
+ */
+
+/* config.h selects 64-bit file offsets, so it must come first */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "xenaccess.h"
+#include "xa_private.h"
+
+/* marks an empty slot in the decompressed chunk cache */
+#define XA_SNAPSHOT_NO_CHUNK 0xffffffff
+
+/* returns the number of bytes of memory held in the given chunk */
+static uint32_t xa_snapshot_chunk_length (
+        struct xa_snapshot_header *header, uint32_t chunk)
+{
+    uint64_t start = (uint64_t) chunk << header->chunk_shift;
+    uint64_t length = header->size - start;
+
+    if (length > (1ULL << header->chunk_shift)){
+        length = 1ULL << header->chunk_shift;
+    }
+    return (uint32_t) length;
+}
+
+/* returns nonzero if the buffer holds only zeros */
+static int xa_snapshot_is_zero (unsigned char *buf, uint32_t length)
+{
+    return 0 == buf[0] && 0 == memcmp(buf, buf + 1, length - 1);
+}
+
+int xa_snapshot_probe (FILE *fhandle)
+{
+    char magic[sizeof(XA_SNAPSHOT_MAGIC) - 1];
+
+    if (pread(fileno(fhandle), magic, sizeof(magic), 0) != sizeof(magic)){
+        return 0;
+    }
+    return 0 == memcmp(magic, XA_SNAPSHOT_MAGIC, sizeof(magic));
+}
+
+static int xa_snapshot_init (xa_instance_t *instance)
+{
+    struct xa_snapshot *snap = NULL;
+    int fildes = fileno(instance->m.file.fhandle);
+    size_t index_size = 0;
+    uint64_t nr_chunks = 0;
+    uint32_t i = 0;
+
+    snap = malloc(sizeof(struct xa_snapshot));
+    if (NULL == snap){
+        fprintf(stderr, "ERROR: failed to allocate snapshot state\n");
+        return XA_FAILURE;
+    }
+    memset(snap, 0, sizeof(struct xa_snapshot));
+    for (i = 0; i < XA_SNAPSHOT_CACHE_CHUNKS; ++i){
+        snap->cache[i].chunk = XA_SNAPSHOT_NO_CHUNK;
+    }
+    instance->m.file.snapshot = snap;
+
+    if (pread(fildes, &snap->header, sizeof(snap->header), 0) !=
+            sizeof(snap->header)){
+        fprintf(stderr, "ERROR: failed to read snapshot header\n");
+        return XA_FAILURE;
+    }
+    nr_chunks = (snap->header.size + (1ULL << snap->header.chunk_shift) - 1)
+        >> snap->header.chunk_shift;
+    if (XA_SNAPSHOT_VERSION != snap->header.version ||
+        instance->page_shift != snap->header.page_shift ||
+        snap->header.chunk_shift < snap->header.page_shift ||
+        snap->header.chunk_shift > 30 ||
+        nr_chunks != snap->header.nr_chunks){
+        fprintf(stderr, "ERROR: unsupported snapshot format\n");
+        return XA_FAILURE;
+    }
+    instance->m.file.size = snap->header.size;
+    xa_dbprint("**set instance->m.file.size = %llu\n", instance->m.file.size);
+    xa_dbprint("--Snapshot: %d chunks of 0x%x bytes\n",
+        snap->header.nr_chunks, 1U << snap->header.chunk_shift);
+
+    /* the index is small, so keep all of it in memory */
+    index_size = snap->header.nr_chunks * sizeof(struct xa_snapshot_chunk);
+    snap->index = malloc(index_size);
+    if (NULL == snap->index){
+        fprintf(stderr, "ERROR: failed to allocate snapshot index\n");
+        return XA_FAILURE;
+    }
+    if (pread(fildes, snap->index, index_size, sizeof(snap->header)) !=
+            index_size){
+        fprintf(stderr, "ERROR: failed to read snapshot index\n");
+        return XA_FAILURE;
+    }
+
+    snap->compressed = malloc(compressBound(1UL << snap->header.chunk_shift));
+    if (NULL == snap->compressed){
+        fprintf(stderr, "ERROR: failed to allocate snapshot buffer\n");
+        return XA_FAILURE;
+    }
+    return XA_SUCCESS;
+}
+
+static int xa_snapshot_destroy (xa_instance_t *instance)
+{
+    struct xa_snapshot *snap = instance->m.file.snapshot;
+    uint32_t i = 0;
+
+    if (NULL != snap){
+        for (i = 0; i < XA_SNAPSHOT_CACHE_CHUNKS; ++i){
+            if (snap->cache[i].data) free(snap->cache[i].data);
+        }
+        if (snap->index) free(snap->index);
+        if (snap->compressed) free(snap->compressed);
+        free(snap);
+    }
+    instance->m.file.snapshot = NULL;
+
+    if (NULL != instance->m.file.fhandle){
+        fclose(instance->m.file.fhandle);
+        instance->m.file.fhandle = NULL;
+    }
+    return XA_SUCCESS;
+}
+
+static uint64_t xa_snapshot_get_size (xa_instance_t *instance)
+{
+    return instance->m.file.size;
+}
+
+static unsigned long xa_snapshot_pfn_to_mfn (
+        xa_instance_t *instance, unsigned long pfn)
+{
+    return pfn;
+}
+
+/* returns the decompressed data for a chunk, reading and decompressing
+   it into the least recently used cache slot if it is not cached */
+static unsigned char *xa_snapshot_get_chunk (
+        xa_instance_t *instance, uint32_t chunk)
+{
+    struct xa_snapshot *snap = instance->m.file.snapshot;
+    struct xa_snapshot_chunk *entry = NULL;
+    struct xa_snapshot_slot *slot = NULL;
+    int fildes = fileno(instance->m.file.fhandle);
+    uint32_t length = 0;
+    uLongf out_length = 0;
+    uint32_t i = 0;
+
+    for (i = 0; i < XA_SNAPSHOT_CACHE_CHUNKS; ++i){
+        if (snap->cache[i].chunk == chunk){
+            snap->cache[i].last_used = ++snap->clock;
+            return snap->cache[i].data;
+        }
+        if (NULL == slot || snap->cache[i].last_used < slot->last_used){
+            slot = &snap->cache[i];
+        }
+    }
+    if (chunk >= snap->header.nr_chunks){
+        return NULL;
+    }
+
+    if (NULL == slot->data){
+        slot->data = malloc(1U << snap->header.chunk_shift);
+        if (NULL == slot->data){
+            return NULL;
+        }
+    }
+    slot->chunk = XA_SNAPSHOT_NO_CHUNK;
+    entry = &snap->index[chunk];
+    length = xa_snapshot_chunk_length(&snap->header, chunk);
+
+    if (entry->flags & XA_SNAPSHOT_ZERO){
+        memset(slot->data, 0, length);
+    }
+    else if (entry->flags & XA_SNAPSHOT_RAW){
+        if (entry->length != length ||
+            pread(fildes, slot->data, length, entry->offset) != length){
+            goto error_exit;
+        }
+    }
+    else{
+        if (entry->length > compressBound(1UL << snap->header.chunk_shift) ||
+            pread(fildes, snap->compressed, entry->length, entry->offset) !=
+                entry->length){
+            goto error_exit;
+        }
+        out_length = length;
+        if (uncompress(slot->data, &out_length,
+                snap->compressed, entry->length) != Z_OK ||
+            out_length != length){
+            goto error_exit;
+        }
+    }
+    xa_dbprint("--Snapshot: loaded chunk %d\n", chunk);
+    slot->chunk = chunk;
+    slot->last_used = ++snap->clock;
+    return slot->data;
+
+error_exit:
+    fprintf(stderr, "ERROR: failed to read snapshot chunk %d\n", chunk);
+    return NULL;
+}
+
+static int xa_snapshot_read (
+        xa_instance_t *instance, uint64_t paddr, void *buf, uint32_t count)
+{
+    struct xa_snapshot *snap = instance->m.file.snapshot;
+    uint64_t chunk_size = 1ULL << snap->header.chunk_shift;
+    unsigned char *data = NULL;
+    uint32_t offset = 0;
+    uint32_t chunk = 0;
+
+    if (paddr >= instance->m.file.size ||
+        count > instance->m.file.size - paddr){
+        return XA_FAILURE;
+    }
+
+    while (count){
+        offset = paddr & (chunk_size - 1);
+        chunk = chunk_size - offset;
+        if (chunk > count){
+            chunk = count;
+        }
+        data = xa_snapshot_get_chunk(
+            instance, paddr >> snap->header.chunk_shift);
+        if (NULL == data){
+            return XA_FAILURE;
+        }
+        memcpy(buf, data + offset, chunk);
+        paddr += chunk;
+        buf = (unsigned char *) buf + chunk;
+        count -= chunk;
+    }
+    return XA_SUCCESS;
+}
+
+/* chunks that are all zeros are holes */
+static uint64_t xa_snapshot_next_data (xa_instance_t *instance, uint64_t paddr)
+{
+    struct xa_snapshot *snap = instance->m.file.snapshot;
+    uint64_t chunk = paddr >> snap->header.chunk_shift;
+
+    while (chunk < snap->header.nr_chunks &&
+           (snap->index[chunk].flags & XA_SNAPSHOT_ZERO)){
+        ++chunk;
+    }
+    if (chunk >= snap->header.nr_chunks){
+        return instance->m.file.size;
+    }
+    chunk <<= snap->header.chunk_shift;
+    return chunk > paddr ? chunk : paddr;
+}
+
+/* pages are handed out as private copies, so a chunk can leave the
+   cache while the caller still holds one of its pages */
+static void *xa_snapshot_map_pages (
+        xa_instance_t *instance, int prot,
+        const unsigned long *pfns, uint32_t num)
+{
+    unsigned char *memory = NULL;
+    uint32_t i = 0;
+
+    if (prot & PROT_WRITE){
+        fprintf(stderr, "ERROR: snapshot images are read-only\n");
+        return NULL;
+    }
+    memory = malloc(num * instance->page_size);
+    if (NULL == memory){
+        return NULL;
+    }
+    for (i = 0; i < num; ++i){
+        if (xa_snapshot_read(instance,
+                (uint64_t) pfns[i] << instance->page_shift,
+                memory + i * instance->page_size,
+                instance->page_size) == XA_FAILURE){
+            free(memory);
+            return NULL;
+        }
+    }
+    return memory;
+}
+
+static void *xa_snapshot_map_page (
+        xa_instance_t *instance, int prot, unsigned long pfn)
+{
+    return xa_snapshot_map_pages(instance, prot, &pfn, 1);
+}
+
+static int xa_snapshot_unmap (
+        xa_instance_t *instance, void *memory, uint32_t length)
+{
+    free(memory);
+    return XA_SUCCESS;
+}
+
+struct xa_backend xa_snapshot_backend = {
+    .name = "snapshot",
+    .init = xa_snapshot_init,
+    .destroy = xa_snapshot_destroy,
+    .get_size = xa_snapshot_get_size,
+    .pfn_to_mfn = xa_snapshot_pfn_to_mfn,
+    .map_page = xa_snapshot_map_page,
+    .map_pages = xa_snapshot_map_pages,
+    .direct_page = NULL,
+    .unmap = xa_snapshot_unmap,
+    .read = xa_snapshot_read,
+    .next_data = xa_snapshot_next_data,
+    .pause = NULL,
+    .resume = NULL,
+    .get_vcpureg = NULL
+};
+
+int xa_write_snapshot (xa_instance_t *instance, char *filename)
+{
+    struct xa_snapshot_header header;
+    struct xa_snapshot_chunk *index = NULL;
+    unsigned char *data = NULL;
+    unsigned char *compressed = NULL;
+    unsigned char *memory = NULL;
+    FILE *f = NULL;
+    uint64_t address = 0;
+    off_t file_offset = 0;
+    uint32_t chunk_size = 1U << XA_SNAPSHOT_CHUNK_SHIFT;
+    uint32_t length = 0;
+    uint32_t offset = 0;
+    uint32_t done = 0;
+    uint32_t i = 0;
+    uLongf out_length = 0;
+    int ret = XA_FAILURE;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, XA_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = XA_SNAPSHOT_VERSION;
+    header.page_shift = instance->page_shift;
+    header.chunk_shift = XA_SNAPSHOT_CHUNK_SHIFT;
+    header.size = instance->backend->get_size(instance);
+    header.nr_chunks = (header.size + chunk_size - 1) >> header.chunk_shift;
+
+    index = malloc(header.nr_chunks * sizeof(struct xa_snapshot_chunk));
+    data = malloc(chunk_size);
+    compressed = malloc(compressBound(chunk_size));
+    if (NULL == index || NULL == data || NULL == compressed){
+        fprintf(stderr, "ERROR: failed to allocate snapshot buffers\n");
+        goto error_exit;
+    }
+
+    if ((f = fopen(filename, "wb")) == NULL){
+        fprintf(stderr, "ERROR: failed to open snapshot file for writing\n");
+        goto error_exit;
+    }
+
+    /* the chunk data goes after the header and index, which are
+       written once all of the chunk offsets are known */
+    file_offset = sizeof(header) +
+        header.nr_chunks * sizeof(struct xa_snapshot_chunk);
+    if (fseeko(f, file_offset, SEEK_SET) != 0){
+        goto write_error;
+    }
+
+    for (i = 0; i < header.nr_chunks; ++i){
+        length = xa_snapshot_chunk_length(&header, i);
+
+        /* gather the chunk a page at a time, unmapped pages are zeros */
+        for (done = 0; done < length; done += instance->page_size){
+            memory = xa_access_pa(instance, address + done, &offset, PROT_READ);
+            if (NULL != memory){
+                memcpy(data + done, memory, instance->page_size);
+                xa_munmap(instance, memory, instance->page_size);
+            }
+            else{
+                memset(data + done, 0, instance->page_size);
+            }
+        }
+
+        index[i].offset = file_offset;
+        if (xa_snapshot_is_zero(data, length)){
+            index[i].length = 0;
+            index[i].flags = XA_SNAPSHOT_ZERO;
+        }
+        else{
+            out_length = compressBound(chunk_size);
+            if (compress2(compressed, &out_length, data, length,
+                    Z_BEST_SPEED) == Z_OK && out_length < length){
+                index[i].length = out_length;
+                index[i].flags = 0;
+                if (fwrite(compressed, 1, out_length, f) != out_length){
+                    goto write_error;
+                }
+            }
+            else{
+                index[i].length = length;
+                index[i].flags = XA_SNAPSHOT_RAW;
+                if (fwrite(data, 1, length, f) != length){
+                    goto write_error;
+                }
+            }
+        }
+        file_offset += index[i].length;
+        address += length;
+    }
+
+    if (fseeko(f, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, f) != 1 ||
+        fwrite(index, sizeof(struct xa_snapshot_chunk),
+            header.nr_chunks, f) != header.nr_chunks){
+        goto write_error;
+    }
+    xa_dbprint("--Snapshot: wrote 0x%llx bytes as 0x%llx bytes\n",
+        header.size, (unsigned long long) file_offset);
+    ret = XA_SUCCESS;
+    goto error_exit;
+
+write_error:
+    fprintf(stderr, "ERROR: failed to write snapshot file\n");
+
+error_exit:
+    if (f && fclose(f) != 0) ret = XA_FAILURE;
+    if (index) free(index);
+    if (data) free(data);
+    if (compressed) free(compressed);
+    return ret;
+}
@@ -28,6 +28,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
 #include "xa_private.h"
@@ -80,3 +81,48 @@ error_exit:
     }
     return ret;
 }
+
+static int xa_prefetch_compare (const void *a, const void *b)
+{
+    return strcmp(((const xa_prefetch_t *) a)->name,
+                  ((const xa_prefetch_t *) b)->name);
+}
+
+void xa_prefetch_sort (xa_prefetch_t *list, uint32_t count)
+{
+    qsort(list, count, sizeof(xa_prefetch_t), xa_prefetch_compare);
+}
+
+/* compares a name that isn't null terminated with a list entry */
+static int xa_prefetch_compare_name (
+    const char *name, size_t length, const char *entry)
+{
+    int cmp = strncmp(name, entry, length);
+    if (cmp){
+        return cmp;
+    }
+    return entry[length] ? -1 : 0;
+}
+
+xa_prefetch_t *xa_prefetch_find (
+    xa_prefetch_t *list, uint32_t count, const char *name, size_t length)
+{
+    uint32_t low = 0;
+    uint32_t high = count;
+
+    /* the first match, so that a name given twice is found once */
+    while (low < high){
+        uint32_t mid = low + (high - low) / 2;
+        if (xa_prefetch_compare_name(name, length, list[mid].name) > 0){
+            low = mid + 1;
+        }
+        else{
+            high = mid;
+        }
+    }
+    if (low < count &&
+        0 == xa_prefetch_compare_name(name, length, list[low].name)){
+        return &list[low];
+    }
+    return NULL;
+}
@@ -0,0 +1,313 @@
+/*
+ * The libxa library provides access to resources in domU machines.
+ *
+ * Copyright (C) 2005 - 2008  Bryan D. Payne (bryan@thepaynes.cc)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * --------------------
+ * This file contains the persistent symbol cache.  Symbol addresses
+ * and kernel layout found by one instance are saved to a file, tagged
+ * with the identity of the kernel (the inode, size and modification time
+ * of the System.map, or the timestamp and checksum of ntoskrnl), and
+ * loaded by the next instance for the same kernel so that it can skip
+ * the symbol file and the search for the kernel image.
+ *
+ * File: xa_symcache.c
+ *
+ * Author(s): Bryan D. Payne (bryan@thepaynes.cc)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "xenaccess.h"
+#include "xa_private.h"
+
+#define XA_SYMCACHE_MAGIC "# XenAccess symbol cache"
+#define XA_SYMCACHE_INITIAL 64
+
+/* finds the identity of the kernel that the symbols belong to */
+static int xa_symcache_identity (xa_instance_t *instance, uint64_t *key)
+{
+    if (XA_OS_LINUX == instance->os_type){
+        return linux_system_map_identity(instance, key);
+    }
+    else if (XA_OS_WINDOWS == instance->os_type &&
+             instance->os.windows_instance.ntoskrnl){
+        return windows_pe_identity(
+            instance, instance->os.windows_instance.ntoskrnl, key);
+    }
+    return XA_FAILURE;
+}
+
+/* binary search, returns the index of name or where it would go */
+static uint32_t xa_symcache_find (
+        struct xa_symcache *symcache, char *name, int *found)
+{
+    uint32_t low = 0;
+    uint32_t high = symcache->count;
+    int cmp = 0;
+
+    *found = 0;
+    while (low < high){
+        uint32_t mid = low + (high - low) / 2;
+        cmp = strcmp(symcache->entries[mid].name, name);
+        if (0 == cmp){
+            *found = 1;
+            return mid;
+        }
+        if (cmp < 0){
+            low = mid + 1;
+        }
+        else{
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static void xa_symcache_clear (struct xa_symcache *symcache)
+{
+    uint32_t i = 0;
+
+    for (i = 0; i < symcache->count; ++i){
+        free(symcache->entries[i].name);
+    }
+    symcache->count = 0;
+}
+
+int xa_symcache_open (xa_instance_t *instance, char *filename)
+{
+    struct xa_symcache *symcache = NULL;
+
+    xa_destroy_symcache(instance);
+    symcache = calloc(1, sizeof(struct xa_symcache));
+    if (NULL == symcache){
+        return XA_FAILURE;
+    }
+    symcache->path = strdup(filename);
+    if (NULL == symcache->path){
+        free(symcache);
+        return XA_FAILURE;
+    }
+    instance->symcache = symcache;
+    xa_dbprint("**set symbol cache file = %s\n", filename);
+    return XA_SUCCESS;
+}
+
+void xa_symcache_load (xa_instance_t *instance)
+{
+    struct xa_symcache *symcache = instance->symcache;
+    FILE *f = NULL;
+    char row[MAX_ROW_LENGTH];
+    char name[MAX_ROW_LENGTH];
+    unsigned long long value = 0;
+    unsigned long long file_key = 0;
+    uint64_t base = 0;
+    int guessed = 0;
+
+    if (NULL == symcache){
+        return;
+    }
+
+    /* a missing file just means that this is the first run */
+    if ((f = fopen(symcache->path, "r")) == NULL){
+        xa_dbprint("--symbol cache %s not found\n", symcache->path);
+        goto identify;
+    }
+    if (fgets(row, MAX_ROW_LENGTH, f) == NULL ||
+        strncmp(row, XA_SYMCACHE_MAGIC, strlen(XA_SYMCACHE_MAGIC)) != 0 ||
+        fgets(row, MAX_ROW_LENGTH, f) == NULL ||
+        sscanf(row, "key %llx", &file_key) != 1){
+        fprintf(stderr, "ERROR: %s is not a symbol cache\n", symcache->path);
+        goto identify;
+    }
+    while (fgets(row, MAX_ROW_LENGTH, f) != NULL){
+        if (sscanf(row, "%llx %199s", &value, name) == 2){
+            xa_symcache_add(instance, name, value);
+        }
+    }
+
+    /* the kernel image is found where it was last time, if it's there */
+    if (XA_OS_WINDOWS == instance->os_type &&
+        0 == instance->os.windows_instance.ntoskrnl &&
+        xa_symcache_lookup(instance, "@ntoskrnl", &base)){
+        instance->os.windows_instance.ntoskrnl = base;
+        guessed = 1;
+    }
+
+identify:
+    if (f) fclose(f);
+    if (xa_symcache_identity(instance, &symcache->key) == XA_FAILURE){
+        symcache->key = 0;
+    }
+
+    /* symbols for a different kernel are thrown away */
+    if (symcache->count && (0 == symcache->key || file_key != symcache->key)){
+        xa_dbprint("--symbol cache is for another kernel\n");
+        xa_symcache_clear(symcache);
+        if (guessed){
+            instance->os.windows_instance.ntoskrnl = 0;
+            symcache->key = 0;
+        }
+    }
+    else if (symcache->count){
+        xa_dbprint("--loaded %u symbols from %s\n",
+            symcache->count, symcache->path);
+    }
+    symcache->dirty = 0;
+}
+
+int xa_symcache_lookup (xa_instance_t *instance, char *name, uint64_t *value)
+{
+    struct xa_symcache *symcache = instance->symcache;
+    uint32_t index = 0;
+    int found = 0;
+
+    if (NULL == symcache){
+        return 0;
+    }
+    index = xa_symcache_find(symcache, name, &found);
+    if (found){
+        *value = symcache->entries[index].value;
+        xa_dbprint("++Symbol cache hit (%s --> 0x%.8llx)\n", name, *value);
+    }
+    return found;
+}
+
+void xa_symcache_add (xa_instance_t *instance, char *name, uint64_t value)
+{
+    struct xa_symcache *symcache = instance->symcache;
+    struct xa_symcache_entry *entry = NULL;
+    uint32_t index = 0;
+    int found = 0;
+
+    if (NULL == symcache){
+        return;
+    }
+    index = xa_symcache_find(symcache, name, &found);
+    if (found){
+        if (symcache->entries[index].value != value){
+            symcache->entries[index].value = value;
+            symcache->dirty = 1;
+        }
+        return;
+    }
+
+    if (symcache->count == symcache->space){
+        uint32_t space = symcache->space ?
+            symcache->space * 2 : XA_SYMCACHE_INITIAL;
+        struct xa_symcache_entry *entries = realloc(
+            symcache->entries, space * sizeof(struct xa_symcache_entry));
+        if (NULL == entries){
+            return;
+        }
+        symcache->entries = entries;
+        symcache->space = space;
+    }
+
+    /* keep the entries sorted by name */
+    entry = &symcache->entries[index];
+    memmove(entry + 1, entry,
+        (symcache->count - index) * sizeof(struct xa_symcache_entry));
+    entry->name = strdup(name);
+    if (NULL == entry->name){
+        memmove(entry, entry + 1,
+            (symcache->count - index) * sizeof(struct xa_symcache_entry));
+        return;
+    }
+    entry->value = value;
+    symcache->count++;
+    symcache->dirty = 1;
+}
+
+/* writes the symbols to a new file that then replaces the old one, so
+   that other instances never read a partial cache */
+static int xa_symcache_save (xa_instance_t *instance)
+{
+    struct xa_symcache *symcache = instance->symcache;
+    char *tmp = NULL;
+    FILE *f = NULL;
+    uint32_t i = 0;
+    int fd = -1;
+    int ret = XA_FAILURE;
+
+    if (0 == symcache->key &&
+        xa_symcache_identity(instance, &symcache->key) == XA_FAILURE){
+        xa_dbprint("--not saving symbols for an unknown kernel\n");
+        return XA_FAILURE;
+    }
+
+    /* a unique name in the same directory, since several tools may be
+       saving the same cache at once and rename must not cross devices */
+    tmp = malloc(strlen(symcache->path) + 8);
+    if (NULL == tmp){
+        return XA_FAILURE;
+    }
+    sprintf(tmp, "%s.XXXXXX", symcache->path);
+    if ((fd = mkstemp(tmp)) == -1){
+        fprintf(stderr, "ERROR: failed to write symbol cache %s\n",
+            symcache->path);
+        goto error_exit;
+    }
+    fchmod(fd, 0644);
+    if ((f = fdopen(fd, "w")) == NULL){
+        fprintf(stderr, "ERROR: failed to write symbol cache %s\n",
+            symcache->path);
+        close(fd);
+        remove(tmp);
+        goto error_exit;
+    }
+    fprintf(f, "%s\nkey %.16llx\n", XA_SYMCACHE_MAGIC,
+        (unsigned long long) symcache->key);
+    for (i = 0; i < symcache->count; ++i){
+        fprintf(f, "%.8llx %s\n",
+            (unsigned long long) symcache->entries[i].value,
+            symcache->entries[i].name);
+    }
+    if (fclose(f) != 0 || rename(tmp, symcache->path) != 0){
+        fprintf(stderr, "ERROR: failed to write symbol cache %s\n",
+            symcache->path);
+        remove(tmp);
+        goto error_exit;
+    }
+    xa_dbprint("--saved %u symbols to %s\n", symcache->count, symcache->path);
+    ret = XA_SUCCESS;
+
+error_exit:
+    free(tmp);
+    return ret;
+}
+
+void xa_destroy_symcache (xa_instance_t *instance)
+{
+    struct xa_symcache *symcache = instance->symcache;
+
+    if (NULL == symcache){
+        return;
+    }
+    if (symcache->dirty){
+        xa_symcache_save(instance);
+    }
+    xa_symcache_clear(symcache);
+    free(symcache->entries);
+    free(symcache->path);
+    free(symcache);
+    instance->symcache = NULL;
+}
@@ -35,79 +35,62 @@
 #include <string.h>
 #include <stdarg.h>
 
-int xa_read_long_mach (
-        xa_instance_t *instance, uint32_t maddr, uint32_t *value)
+/* copies memory at a machine address; only Xen has machine frames that
+   differ from physical ones, so the other backends read it directly and
+   Xen maps the frame through the page cache */
+static int xa_read_ma (
+        xa_instance_t *instance, uint64_t maddr, void *buf, uint32_t count)
 {
     unsigned char *memory = NULL;
     uint32_t offset = 0;
-    memory = xa_access_ma(instance, maddr, &offset, PROT_READ);
-    if (NULL != memory){
-        *value = *((uint32_t*)(memory + offset));
-        munmap(memory, instance->page_size);
-        return XA_SUCCESS;
+
+    if (XA_MODE_XEN != instance->mode){
+        return xa_read_pa(instance, maddr, buf, count);
     }
-    else{
+    memory = xa_access_ma(instance, maddr, &offset, PROT_READ);
+    if (NULL == memory){
         return XA_FAILURE;
     }
+    memcpy(buf, memory + offset, count);
+    instance->stats.bytes_read += count;
+    xa_munmap(instance, memory, instance->page_size);
+    return XA_SUCCESS;
+}
+
+int xa_read_long_mach (
+        xa_instance_t *instance, uint64_t maddr, uint32_t *value)
+{
+    return xa_read_ma(instance, maddr, value, sizeof(*value));
 }
 
 int xa_read_long_long_mach (
-        xa_instance_t *instance, uint32_t maddr, uint64_t *value)
+        xa_instance_t *instance, uint64_t maddr, uint64_t *value)
 {
-    unsigned char *memory = NULL;
-    uint32_t offset = 0;
-    memory = xa_access_ma(instance, maddr, &offset, PROT_READ);
-    if (NULL != memory){
-        *value = *((uint64_t*)(memory + offset));
-        munmap(memory, instance->page_size);
-        return XA_SUCCESS;
-    }
-    else{
-        return XA_FAILURE;
-    }
+    return xa_read_ma(instance, maddr, value, sizeof(*value));
 }
 
 int xa_read_long_phys (
-        xa_instance_t *instance, uint32_t paddr, uint32_t *value)
+        xa_instance_t *instance, uint64_t paddr, uint32_t *value)
 {
-    unsigned char *memory = NULL;
-    uint32_t offset = 0;
-    memory = xa_access_pa(instance, paddr, &offset, PROT_READ);
-    if (NULL != memory){
-        *value = *((uint32_t*)(memory + offset));
-        munmap(memory, instance->page_size);
-        return XA_SUCCESS;
-    }
-    else{
-        return XA_FAILURE;
-    }
+    return xa_read_pa(instance, paddr, value, sizeof(*value));
 }
 
 int xa_read_long_long_phys (
-        xa_instance_t *instance, uint32_t paddr, uint64_t *value)
+        xa_instance_t *instance, uint64_t paddr, uint64_t *value)
 {
-    unsigned char *memory = NULL;
-    uint32_t offset = 0;
-    memory = xa_access_pa(instance, paddr, &offset, PROT_READ);
-    if (NULL != memory){
-        *value = *((uint64_t*)(memory + offset));
-        munmap(memory, instance->page_size);
-        return XA_SUCCESS;
-    }
-    else{
-        return XA_FAILURE;
-    }
+    return xa_read_pa(instance, paddr, value, sizeof(*value));
 }
 
 int xa_read_long_virt (
-        xa_instance_t *instance, uint32_t vaddr, int pid, uint32_t *value)
+        xa_instance_t *instance, xa_addr_t vaddr, int pid, uint32_t *value)
 {
     unsigned char *memory = NULL;
     uint32_t offset = 0;
     memory = xa_access_user_va(instance, vaddr, &offset, pid, PROT_READ);
     if (NULL != memory){
         *value = *((uint32_t*)(memory + offset));
-        munmap(memory, instance->page_size);
+        instance->stats.bytes_read += sizeof(*value);
+        xa_munmap(instance, memory, instance->page_size);
         return XA_SUCCESS;
     }
     else{
@@ -116,14 +99,15 @@ int xa_read_long_virt (
 }
 
 int xa_read_long_long_virt (
-        xa_instance_t *instance, uint32_t vaddr, int pid, uint64_t *value)
+        xa_instance_t *instance, xa_addr_t vaddr, int pid, uint64_t *value)
 {
     unsigned char *memory = NULL;
     uint32_t offset = 0;
     memory = xa_access_user_va(instance, vaddr, &offset, pid, PROT_READ);
     if (NULL != memory){
         *value = *((uint64_t*)(memory + offset));
-        munmap(memory, instance->page_size);
+        instance->stats.bytes_read += sizeof(*value);
+        xa_munmap(instance, memory, instance->page_size);
         return XA_SUCCESS;
     }
     else{
@@ -139,7 +123,8 @@ int xa_read_long_sym (
     memory = xa_access_kernel_sym(instance, sym, &offset, PROT_READ);
     if (NULL != memory){
         *value = *((uint32_t*)(memory + offset));
-        munmap(memory, instance->page_size);
+        instance->stats.bytes_read += sizeof(*value);
+        xa_munmap(instance, memory, instance->page_size);
         return XA_SUCCESS;
     }
     else{
@@ -155,7 +140,8 @@ int xa_read_long_long_sym (
     memory = xa_access_kernel_sym(instance, sym, &offset, PROT_READ);
     if (NULL != memory){
         *value = *((uint64_t*)(memory + offset));
-        munmap(memory, instance->page_size);
+        instance->stats.bytes_read += sizeof(*value);
+        xa_munmap(instance, memory, instance->page_size);
         return XA_SUCCESS;
     }
     else{
@@ -176,6 +162,82 @@ int xa_symbol_to_address (xa_instance_t *instance, char *sym, uint32_t *vaddr)
     }
 }
 
+/* kernel virtual address of a symbol found by xa_prefetch_symbols */
+static uint32_t xa_prefetch_vaddr (xa_instance_t *instance, uint32_t address)
+{
+    if (XA_OS_WINDOWS == instance->os_type){
+        return instance->os.windows_instance.ntoskrnl + address +
+            instance->page_offset;
+    }
+    return address;
+}
+
+uint32_t xa_prefetch_symbols (
+    xa_instance_t *instance, const char **names, uint32_t num)
+{
+    xa_prefetch_t *list = NULL;
+    uint32_t count = 0;
+    uint32_t found = 0;
+    uint64_t value = 0;
+    uint32_t i = 0;
+
+    if (XA_OS_LINUX != instance->os_type &&
+        XA_OS_WINDOWS != instance->os_type){
+        return 0;
+    }
+    if (NULL == (list = malloc(num * sizeof(xa_prefetch_t))) && num){
+        return 0;
+    }
+
+    /* the symbols would push each other out of a smaller cache */
+    if (instance->cache_size && instance->cache_size < num){
+        xa_set_cache_size(instance, num);
+    }
+
+    /* only look for the symbols that aren't known already */
+    for (i = 0; i < num; ++i){
+        if (xa_symcache_lookup(instance, (char *) names[i], &value)){
+            xa_update_cache(instance, (char *) names[i],
+                xa_prefetch_vaddr(instance, (uint32_t) value), 0, 0);
+            ++found;
+            continue;
+        }
+        list[count].name = names[i];
+        list[count].address = 0;
+        list[count].found = 0;
+        ++count;
+    }
+
+    if (count){
+        xa_prefetch_sort(list, count);
+        if (XA_OS_LINUX == instance->os_type){
+            linux_system_map_prefetch(instance, list, count);
+        }
+        else{
+            windows_export_prefetch(instance, list, count);
+        }
+    }
+
+    for (i = 0; i < count; ++i){
+        /* a name given twice is only found once */
+        if (!list[i].found && i > 0 &&
+            strcmp(list[i].name, list[i - 1].name) == 0){
+            list[i] = list[i - 1];
+        }
+        if (!list[i].found){
+            xa_dbprint("--Prefetch: symbol %s not found\n", list[i].name);
+            continue;
+        }
+        xa_symcache_add(instance, (char *) list[i].name, list[i].address);
+        xa_update_cache(instance, (char *) list[i].name,
+            xa_prefetch_vaddr(instance, list[i].address), 0, 0);
+        ++found;
+    }
+
+    free(list);
+    return found;
+}
+
 int xa_get_bit (unsigned long reg, int bit)
 {
     unsigned long mask = 1 << bit;
@@ -191,23 +253,41 @@ void *xa_map_page (xa_instance_t *instance, int prot, unsigned long frame_num)
 {
     void *memory = NULL;
 
-    if (XA_MODE_XEN == instance->mode){
-#ifdef ENABLE_XEN
-        memory = xc_map_foreign_range(
-            instance->m.xen.xc_handle,
-            instance->m.xen.domain_id,
-            1,
-            prot,
-            frame_num);
-#endif /* ENABLE_XEN */
+    if (PROT_READ == prot){
+        /* some backends keep all of memory mapped already */
+        if (NULL != instance->backend->direct_page){
+            memory = instance->backend->direct_page(instance, frame_num);
+            if (NULL != memory){
+                instance->stats.page_maps++;
+                return memory;
+            }
+        }
+
+        memory = xa_check_page_cache(instance, frame_num);
+        if (NULL != memory){
+            return memory;
+        }
     }
-    else if (XA_MODE_FILE == instance->mode){
-        memory = xa_map_file_range(instance, prot, frame_num);
+
+    memory = instance->backend->map_page(instance, prot, frame_num);
+    if (NULL != memory){
+        instance->stats.page_maps++;
     }
-    else{
-        xa_dbprint("BUG: invalid mode\n");
+
+    if (PROT_READ == prot && NULL != memory){
+        xa_update_page_cache(instance, frame_num, memory);
     }
+    return memory;
+}
 
+void *xa_map_pages (
+        xa_instance_t *instance, int prot,
+        const unsigned long *frames, uint32_t num)
+{
+    void *memory = instance->backend->map_pages(instance, prot, frames, num);
+    if (NULL != memory){
+        instance->stats.page_maps += num;
+    }
     return memory;
 }
 
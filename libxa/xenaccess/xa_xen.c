@@ -0,0 +1,228 @@
+/*
+ * The libxa library provides access to resources in domU machines.
+ *
+ * Copyright (C) 2005 - 2008  Bryan D. Payne (bryan@thepaynes.cc)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * --------------------
+ * This file contains the memory backend for live Xen domains, which
+ * accesses guest memory through libxc.
+ *
+ * File: xa_xen.c
+ *
+ * Author(s): Bryan D. Payne (bryan@thepaynes.cc)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "xenaccess.h"
+#include "xa_private.h"
+
+#ifdef ENABLE_XEN
+#include <xs.h>
+
+static int xa_xen_init (xa_instance_t *instance)
+{
+    int ret = XA_SUCCESS;
+    struct xs_handle *xsh = NULL;
+    xs_transaction_t xth = XBT_NULL;
+    char *tmp = malloc(100);
+    if (NULL == tmp){
+        fprintf(stderr, "ERROR: failed to allocate memory for tmp variable\n");
+        ret = XA_FAILURE;
+        goto error_exit;
+    }
+    memset(tmp, 0, 100);
+    sprintf(tmp, "/local/domain/%d/memory/target",
+        instance->m.xen.domain_id);
+    xsh = xs_domain_open();
+    instance->m.xen.size =
+        strtoull(xs_read(xsh, xth, tmp, NULL), NULL, 10) * 1024;
+    if (0 == instance->m.xen.size){
+        fprintf(stderr, "ERROR: failed to get memory size for Xen domain.\n");
+        ret = XA_FAILURE;
+        goto error_exit;
+    }
+    xa_dbprint("**set instance->m.xen.size = %llu\n", instance->m.xen.size);
+
+error_exit:
+    if (xsh) xs_daemon_close(xsh);
+    if (tmp) free(tmp);
+    return ret;
+}
+
+static int xa_xen_destroy (xa_instance_t *instance)
+{
+    if (instance->m.xen.live_pfn_to_mfn_table){
+        munmap(instance->m.xen.live_pfn_to_mfn_table,
+               instance->m.xen.nr_pfns * 4);
+        instance->m.xen.live_pfn_to_mfn_table = NULL;
+    }
+    instance->m.xen.domain_id = 0;
+
+    if (xc_interface_close(instance->m.xen.xc_handle) != 0){
+        return XA_FAILURE;
+    }
+    return XA_SUCCESS;
+}
+
+static uint64_t xa_xen_get_size (xa_instance_t *instance)
+{
+    return instance->m.xen.size;
+}
+
+static void *xa_xen_map_page (
+        xa_instance_t *instance, int prot, unsigned long frame_num)
+{
+    return xc_map_foreign_range(
+        instance->m.xen.xc_handle,
+        instance->m.xen.domain_id,
+        1,
+        prot,
+        frame_num);
+}
+
+static void *xa_xen_map_pages (
+        xa_instance_t *instance, int prot,
+        const unsigned long *frames, uint32_t num)
+{
+    void *memory = NULL;
+    uint32_t i = 0;
+    xen_pfn_t *mfns = malloc(num * sizeof(xen_pfn_t));
+
+    if (NULL == mfns){
+        return NULL;
+    }
+    for (i = 0; i < num; ++i){
+        mfns[i] = frames[i];
+    }
+    memory = xc_map_foreign_pages(
+        instance->m.xen.xc_handle,
+        instance->m.xen.domain_id,
+        prot,
+        mfns,
+        num);
+    free(mfns);
+    return memory;
+}
+
+static int xa_xen_unmap (xa_instance_t *instance, void *memory, uint32_t length)
+{
+    if (munmap(memory, length) != 0){
+        return XA_FAILURE;
+    }
+    return XA_SUCCESS;
+}
+
+/* copies one page at a time, through the page cache */
+static int xa_xen_read (
+        xa_instance_t *instance, uint64_t paddr, void *buf, uint32_t count)
+{
+    unsigned char *memory = NULL;
+    uint32_t offset = 0;
+    uint32_t chunk = 0;
+
+    while (count){
+        memory = xa_access_pa(instance, paddr, &offset, PROT_READ);
+        if (NULL == memory){
+            return XA_FAILURE;
+        }
+        chunk = instance->page_size - offset;
+        if (chunk > count){
+            chunk = count;
+        }
+        memcpy(buf, memory + offset, chunk);
+        xa_munmap(instance, memory, instance->page_size);
+        paddr += chunk;
+        buf = (unsigned char *) buf + chunk;
+        count -= chunk;
+    }
+    return XA_SUCCESS;
+}
+
+static int xa_xen_pause (xa_instance_t *instance)
+{
+    if (xc_domain_pause(
+            instance->m.xen.xc_handle, instance->m.xen.domain_id) != 0){
+        return XA_FAILURE;
+    }
+    return XA_SUCCESS;
+}
+
+static int xa_xen_resume (xa_instance_t *instance)
+{
+    if (xc_domain_unpause(
+            instance->m.xen.xc_handle, instance->m.xen.domain_id) != 0){
+        return XA_FAILURE;
+    }
+    return XA_SUCCESS;
+}
+
+static int xa_xen_get_vcpureg (
+        xa_instance_t *instance, int reg, int vcpu, uint64_t *value)
+{
+#ifdef HAVE_CONTEXT_ANY
+    vcpu_guest_context_any_t ctxt_any;
+#endif /* HAVE_CONTEXT_ANY */
+    vcpu_guest_context_t ctxt;
+
+#ifdef HAVE_CONTEXT_ANY
+    if (xc_vcpu_getcontext(
+            instance->m.xen.xc_handle,
+            instance->m.xen.domain_id,
+            vcpu,
+            &ctxt_any) != 0){
+        return XA_FAILURE;
+    }
+    ctxt = ctxt_any.c;
+#else
+    if (xc_vcpu_getcontext(
+            instance->m.xen.xc_handle,
+            instance->m.xen.domain_id,
+            vcpu,
+            &ctxt) != 0){
+        return XA_FAILURE;
+    }
+#endif /* HAVE_CONTEXT_ANY */
+
+    if (reg < 0 || reg >= 8){
+        return XA_FAILURE;
+    }
+    *value = ctxt.ctrlreg[reg];
+    return XA_SUCCESS;
+}
+
+struct xa_backend xa_xen_backend = {
+    .name = "xen",
+    .init = xa_xen_init,
+    .destroy = xa_xen_destroy,
+    .get_size = xa_xen_get_size,
+    .pfn_to_mfn = helper_pfn_to_mfn,
+    .map_page = xa_xen_map_page,
+    .map_pages = xa_xen_map_pages,
+    .direct_page = NULL,
+    .unmap = xa_xen_unmap,
+    .read = xa_xen_read,
+    .next_data = NULL,
+    .pause = xa_xen_pause,
+    .resume = xa_xen_resume,
+    .get_vcpureg = xa_xen_get_vcpureg
+};
+
+#endif /* ENABLE_XEN */